@@ -11,12 +11,40 @@
 #define MAXLINELENGTH 255   /* Maximum length of a line (all characters after 255 are not loaded) */
 #define MAXINPUTLENGTH 1024 /* Maximum length of user input */
 #define EPSILON 0.000001
+#define TASKSLICE 100       /* Number of steps a task runs before the next task gets its turn */
+#define CHANNELCAPACITY 64  /* Maximum number of values waiting in a channel */
+#define SOCKETBUFFER 4096   /* Bytes read from a connection at a time */
+#define MAXPENDINGOUTPUT 65536 /* Bytes a connection may have waiting to be sent before writers wait */
+#define MAXPENDINGINPUT 65536 /* Bytes a connection may have received and not read before it stops reading */
+#define COMPILECACHE 256    /* Number of compiled blocks kept around for reuse */
+#define MEMOCACHE 1024      /* Number of memoized results kept around for reuse */
+#define IMAGEHEADER "POLARIS IMAGE 1\n" /* First line of an image file */
+#define REGEXCACHE 64       /* Number of compiled regular expressions kept around for reuse */
+#define MAXREGEXLENGTH 10000 /* Maximum number of instructions of a compiled regular expression */
+#define MAXCAPTURES 10      /* Groups a regular expression can capture, counting the whole match */
+#define BIGLIMBS 64         /* Limbs of four digits in an exact whole number, so up to 256 digits */
+#define NUMBERLENGTH 300    /* Room for the text of any number an operation produces */
+#define PROFILEINTERVAL 10  /* Milliseconds of processor time between profile samples */
+#define PROFILESTEPS 10000  /* Steps between profile samples on systems without a profiling timer */
+#define PROFILECACHE 256    /* Buckets of the distinct call stacks a profile has counted */
+#define ORIGINCACHE 256     /* Buckets of the files and lines known blocks start at */
+#define MAXPROFILEDEPTH 64  /* Innermost calls a profile sample keeps */
+#define INLINEVALUE 16      /* Values shorter than this are kept inside their stack element */
+#define MAXMAPWORKERS 64    /* Threads that can evaluate the elements of a map at the same time */
 
 
 /* --- Includes --- */
 #if OS_TYPE == 1
-    #define _POSIX_C_SOURCE 200112L
+    #define _XOPEN_SOURCE 600
     #include "unistd.h"
+    #include "errno.h"
+    #include "fcntl.h"
+    #include "poll.h"
+    #include "netdb.h"
+    #include "sys/types.h"
+    #include "sys/socket.h"
+    #include "sys/time.h"
+    #include "pthread.h"
 #elif OS_TYPE == 2
     #include "dos.h"
 #elif OS_TYPE == 3
@@ -27,6 +55,12 @@
 #include "string.h"
 #include "math.h"
 #include "time.h"
+#include "setjmp.h"
+#include "limits.h"
+#include "signal.h"
+#ifndef CLOCKS_PER_SEC
+    #define CLOCKS_PER_SEC CLK_TCK
+#endif
 
 
 /* --- Types --- */
@@ -36,25 +70,440 @@
 #define null 0
 #define pnumber double
 #define pnumber_i long
+#define MEMORY_STACK 0      /* Stack elements and their values */
+#define MEMORY_VARIABLES 1  /* Variables, their names and values */
+#define MEMORY_STRINGS 2    /* Sources, input and working copies of text */
+#define MEMORY_CODE 3       /* Compiled blocks and translations */
+#define MEMORY_OTHER 4      /* Frames, tasks, timers, channels, generators, connections, memos, maps and profiles */
+#define MEMORY_CATEGORIES 5
+typedef union memory_header memory_header;
+union memory_header {
+    /* Placed before every allocation so it can be accounted for when it is freed */
+    struct {
+        size_t size;
+        int category;
+    } block;
+    pnumber number_alignment;   /* Keeps what follows aligned for any type */
+    void * pointer_alignment;
+    long long_alignment;
+};
 typedef struct stack_element stack_element;
 struct stack_element {
     stack_element * next;
-    char * value;
+    char * value;                   /* Points to inline_value for short values */
+    char inline_value[INLINEVALUE];
 };
+typedef struct code_block code_block;
 typedef struct var_element var_element;
 struct var_element {
     var_element * next;
     char * value;
     char * name;
+    code_block * code;  /* The value compiled, once it has been called with name% */
+    int memo_inputs;    /* Number of inputs of a memoized function, -1 if it isn't memoized */
+    unsigned long scope; /* Scope frame the variable was created in, 0 if it outlives them */
+};
+typedef struct source_origin source_origin;
+struct source_origin {
+    source_origin * next;   /* Next origin in the same bucket */
+    unsigned long hash;     /* Of the source of the block */
+    char * source;          /* Copy of it, blocks can share a hash */
+    char * file;
+    unsigned long line;     /* Line the block starts at */
+    size_t * breaks;        /* Positions in the block that ended a line */
+    size_t break_count;
+};
+typedef struct profile_entry profile_entry;
+struct profile_entry {
+    profile_entry * next;   /* Next entry in the same bucket */
+    char * stack;           /* Calls from the outermost in, separated by ; */
+    unsigned long hash;
+    unsigned long samples;
+};
+typedef struct memo_entry memo_entry;
+struct memo_entry {
+    memo_entry * next;  /* Next entry in the same bucket */
+    memo_entry * older; /* Entries are kept from most to least recently used */
+    memo_entry * newer;
+    char * function;
+    char * key;         /* Function name and inputs */
+    unsigned long hash;
+    char ** outputs;    /* Values the function left, bottom first */
+    size_t output_count;
+};
+#define WORD_PRINT 0
+#define WORD_ADD 1
+#define WORD_SUBTRACT 2
+#define WORD_MULTIPLY 3
+#define WORD_DIVIDE 4
+#define WORD_MODULO 5
+#define WORD_DIVIDE_INT 6
+#define WORD_POWER 7
+#define WORD_SIN 8
+#define WORD_COS 9
+#define WORD_TAN 10
+#define WORD_LOG 11
+#define WORD_EQUAL 12
+#define WORD_NOT_EQUAL 13
+#define WORD_NOT 14
+#define WORD_LESS 15
+#define WORD_GREATER 16
+#define WORD_LESS_EQUAL 17
+#define WORD_GREATER_EQUAL 18
+#define WORD_AND 19
+#define WORD_OR 20
+#define WORD_EVAL 21
+#define WORD_SET 22
+#define WORD_GET 23
+#define WORD_IF 24
+#define WORD_WHILE 25
+#define WORD_JOIN 26
+#define WORD_SPAWN 27
+#define WORD_SEND 28
+#define WORD_RECV 29
+#define WORD_SERVE 30
+#define WORD_CONNECT 31
+#define WORD_READ 32
+#define WORD_EOF 33
+#define WORD_WRITE 34
+#define WORD_CLOSE 35
+#define WORD_GENERATOR 36
+#define WORD_YIELD 37
+#define WORD_NEXT 38
+#define WORD_MAP 39
+#define WORD_COPY 40
+#define WORD_DEL 41
+#define WORD_SWAP 42
+#define WORD_INPUT 43
+#define WORD_RANDOM 44
+#define WORD_EXIT 45
+#define WORD_IMPORT 46
+#define WORD_SLEEP 47
+#define WORD_AFTER 48
+#define WORD_EVERY 49
+#define WORD_CANCEL 50
+#define WORD_MEMO 51
+#define WORD_SEED 52
+#define WORD_RANDINT 53
+#define WORD_RANDINTS 54
+#define WORD_UNSET 55
+#define WORD_SCOPE 56
+#define WORD_MATCH 57
+#define WORD_SEARCH 58
+#define WORD_CAPTURES 59
+#define WORD_GSUB 60
+#define WORD_FORMAT 61
+#define WORD_UNSETALL 62
+#define RESERVED_WORDS 63
+#define WORD_SET_VAR 63  /* >var */
+#define WORD_GET_VAR 64  /* @var */
+#define WORD_CALL 65     /* name% */
+#define WORD_NUMBER 66
+#define WORD_STRING 67
+#define TOKEN_PUSH 0  /* Pushes text */
+#define TOKEN_WORD 1  /* Evaluates word, text holds the variable name if it needs one */
+#define TOKEN_FUSED 2 /* Gets variable text, applies each operation with its constant operand
+                         and then sets variable target to the result, or pushes it if there is no target */
+#define TOKEN_IF 3    /* if with literal condition, if and else blocks */
+#define TOKEN_WHILE 4 /* while with literal condition and body blocks */
+typedef struct var_cache var_cache;
+struct var_cache {
+    var_element * var;          /* Variable found the last time the token ran */
+    unsigned long generation;   /* Value of variables_generation when it was found */
+};
+typedef struct token token;
+struct token {
+    int kind;
+    int word;
+    char * text;
+    char * target;
+    int * operations;
+    char ** operands;
+    size_t operation_count;
+    code_block * blocks[3];
+    var_cache variable;         /* Variable named by text */
+    var_cache target_variable;  /* Variable named by target */
+    size_t offset;              /* Where the token starts in the source of its block */
+    unsigned long line;         /* Line of its file, 0 if it isn't known */
+};
+struct code_block {
+    code_block * next;  /* Next block in the same compile cache bucket */
+    char * source;
+    unsigned long hash;
+    token * tokens;
+    size_t token_count;
+    unsigned int references;
+    bool effect_known;  /* The effect of every token is known before running it */
+    int needs;          /* Values taken from below the stack the block starts with */
+    int net;            /* Values added (or removed if negative) by the whole block */
+    int peak;           /* Highest the stack grows above where it started */
+    char * file;        /* File the block was written in, null if it isn't known */
+    char * name;        /* Function the block was first called as, null if none */
+};
+typedef struct translation translation;
+struct translation {
+    code_block * code;
+    int parent;         /* Block with the token this block comes from, -1 for a source */
+    size_t token_index;
+    int nested;         /* Block of the if or while token, -1 for a pushed block */
+    char * source;      /* Source of the main program or of an imported file */
+    char * base_path;   /* Base path the block runs with, if it is known before running */
+    bool function;      /* Translated as a C function of its own */
+};
+typedef struct translated_function translated_function;
+struct translated_function {
+    char * name;
+    char * body;        /* Block assigned to the variable */
+    int parent;         /* Where the body is pushed */
+    size_t token_index;
+    int slot;           /* Translation of the body, -1 if it hasn't been translated */
+    bool called;
+    bool ambiguous;     /* More than one body is assigned to the variable */
+};
+#define FRAME_EVAL 0  /* Evaluates code */
+#define FRAME_IF 1    /* Waits for a condition to choose between code and alternate */
+#define FRAME_WHILE 2 /* Evaluates code (condition) and alternate (body) in turns */
+#define FRAME_MEMO 3  /* Evaluates code (a memoized function) on its own stack and remembers the result */
+#define FRAME_SCOPE 4 /* Evaluates code and deletes the variables it created */
+typedef struct frame frame;
+struct frame {
+    frame * next;
+    int kind;
+    code_block * code;
+    code_block * alternate;
+    char * base_path;
+    bool owns_base_path;
+    bool checking;
+    size_t position;
+    stack_element * saved_stack; /* Stack of the caller of a memoized function */
+    char * key;                  /* Inputs of a memoized function */
+    unsigned long scope;         /* Number of a scope frame */
+};
+#define RUN_DONE 0    /* Every frame above the stopping frame has finished */
+#define RUN_WAITING 1 /* The task is waiting on a channel */
+#define RUN_YIELDED 2 /* The task used up its slice */
+typedef struct task task;
+struct task {
+    task * next;
+    frame * frames;
+    stack_element * stack;
+    bool sleeping;
+    unsigned long wake_at;
+    bool native;        /* Runs translated code instead of frames */
+};
+typedef struct timer timer;
+struct timer {
+    timer * next;
+    char * source;
+    char * base_path;
+    unsigned long id;
+    unsigned long due;
+    unsigned long interval; /* 0 for timers that fire only once */
+};
+typedef struct generator generator;
+struct generator {
+    generator * next;
+    unsigned long id;
+    frame * frames;
+    stack_element * stack;
+    stack_element * yielded; /* Value handed over by the last yield */
+    bool finished;
+};
+typedef struct connection connection;
+struct connection {
+    int descriptor;
+    bool listening;
+    bool connecting;
+    bool closing;     /* Close once everything pending has been sent */
+    bool closed;      /* The peer has closed the connection */
+    char * inbound;
+    size_t inbound_start;
+    size_t inbound_length;
+    char * outbound;
+    size_t outbound_length;
+    char * handler;   /* Listeners: block spawned for every accepted connection */
+    char * base_path;
+};
+#define REGEX_CHAR 0    /* Reads the character in argument */
+#define REGEX_ANY 1     /* Reads any character but a newline */
+#define REGEX_CLASS 2   /* Reads a character of the class in argument */
+#define REGEX_SPLIT 3   /* Goes on at target and at alternate, preferring target */
+#define REGEX_JUMP 4    /* Goes on at target */
+#define REGEX_SAVE 5    /* Remembers the position in capture slot argument */
+#define REGEX_START 6   /* Only goes on at the start of the text */
+#define REGEX_END 7     /* Only goes on at the end of the text */
+#define REGEX_MATCH 8
+typedef struct regex_instruction regex_instruction;
+struct regex_instruction {
+    int kind;
+    int argument;
+    int target;
+    int alternate;
+};
+typedef struct regex regex;
+struct regex {
+    regex * next;
+    char * pattern;
+    unsigned long hash;
+    regex_instruction * program;
+    int length;
+    int capacity;
+    unsigned char * classes;    /* A bit for every character, 32 bytes per class */
+    int class_count;
+    int groups;                 /* Capturing groups, the whole match is group 0 */
+    int first;                  /* Character every match starts with, -1 if there isn't one */
+    bool anchored;              /* Matches can only start at the start of the text */
+    int * threads;              /* Working space for matching, two lists of threads */
+    long * thread_captures;
+    int * stack;
+    long * stack_captures;
+    unsigned long * marks;      /* Generation each instruction was last added in */
+    unsigned long generation;
+};
+typedef struct big_integer big_integer;
+struct big_integer {
+    int sign;                   /* 1 or -1 */
+    int length;                 /* Limbs in use, 0 for zero */
+    int limbs[BIGLIMBS + 1];    /* Base 10000, least significant first, with a limb to spare for division */
+};
+typedef struct channel channel;
+struct channel {
+    channel * next;
+    char * name;
+    stack_element * first;
+    stack_element * last;
+    size_t count;
+};
+#if OS_TYPE == 1
+typedef struct map_job map_job;
+struct map_job {
+    code_block * code;
+    char * list;
+    size_t * starts;    /* Where each element starts in list */
+    size_t * ends;
+    char ** results;    /* Value each element left on top of its stack */
+    size_t count;
+    size_t next;        /* First element no worker has taken yet */
+    bool failed;        /* An element failed, so the map is run again in order */
 };
+typedef struct map_worker map_worker;
+struct map_worker {
+    pthread_t thread;
+    char ** values;     /* Private stack, bottom first */
+    size_t value_count;
+    size_t value_capacity;
+    jmp_buf failure;    /* Where errors go while the worker evaluates an element */
+    long memory_in_use[MEMORY_CATEGORIES];  /* Counted during a map, added to the totals after it */
+    long memory_peak[MEMORY_CATEGORIES];
+    long memory_blocks[MEMORY_CATEGORIES];
+    unsigned long memory_allocations[MEMORY_CATEGORIES];
+};
+#endif
 
 
 /* --- Global Variables --- */
 char filename[255];
+char image_to_load[255];
+char image_to_save[255];
 bool display_memory_information = false;
 stack_element * stack = null;
 var_element * variables = null;
+unsigned long variables_generation = 1; /* Changes whenever a variable is added or removed */
+size_t variable_count = 0;
+var_element * free_variables = null; /* Deleted variables kept, with their names, for new ones */
+size_t free_variable_count = 0;
+unsigned long scope_count = 0;
 bool show_pushpops = false;
+bool translate_program = false;
+bool serve_jobs = false;
+bool running_jobs = false;
+jmp_buf job_failure;
+char * job_source = null;
+FILE * program_output = null;
+frame * frames = null;
+task * tasks = null;
+task * current_task = null;
+task * main_task = null;
+stack_element * main_stack = null;
+bool main_running = false;
+channel * channels = null;
+timer * timers = null;
+unsigned long timer_count = 0;
+unsigned long executed_steps = 0;
+unsigned int nested_evaluations = 0;
+generator * generators = null;
+generator * current_generator = null;
+unsigned long generator_count = 0;
+connection ** connection_table = null;
+int connection_table_size = 0;
+unsigned int connection_count = 0;
+unsigned int listener_count = 0;
+connection * stdin_connection = null; /* Read by the reactor for input on Unix, outside the connection table */
+bool input_waiting = false;           /* A task is waiting for a line of input */
+stack_element * free_elements = null;
+size_t free_element_count = 0;
+code_block * compiled_blocks[COMPILECACHE];
+size_t compiled_block_count = 0;
+translation * translations = null;
+int translation_count = 0;
+translated_function * translated_functions = null;
+int translated_function_count = 0;
+int translated_label_count = 0;
+memo_entry * memo_entries[MEMOCACHE];
+memo_entry * newest_memo = null;
+memo_entry * oldest_memo = null;
+size_t memo_count = 0;
+unsigned long memo_hits = 0;
+unsigned long memo_misses = 0;
+regex * compiled_regexes[REGEXCACHE];
+size_t compiled_regex_count = 0;
+#if OS_TYPE == 1
+map_worker map_workers[MAXMAPWORKERS]; /* The first one is the thread that runs the program */
+int map_worker_count = 0;       /* Started when the first map that can use them runs */
+int map_busy_workers = 0;       /* Helper threads still working on the current map */
+unsigned long map_round = 0;    /* Maps handed to the helper threads so far */
+map_job * current_map = null;
+bool map_running = false;       /* Every worker is evaluating elements of current_map */
+pthread_mutex_t map_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t map_work_ready = PTHREAD_COND_INITIALIZER;
+pthread_cond_t map_work_done = PTHREAD_COND_INITIALIZER;
+pthread_key_t map_worker_key;   /* Worker of the calling thread */
+#endif
+unsigned long memory_in_use[MEMORY_CATEGORIES];   /* Bytes */
+unsigned long memory_peak[MEMORY_CATEGORIES];
+unsigned long memory_blocks[MEMORY_CATEGORIES];   /* Allocations not freed yet */
+unsigned long memory_allocations[MEMORY_CATEGORIES];
+char * memory_categories[MEMORY_CATEGORIES] = {
+    "stack", "variables", "strings", "code", "other"
+};
+unsigned long random_state[4]; /* xoshiro128** generator, 32 bits in each word */
+char profile_to_write[255];
+bool profiling = false;
+volatile sig_atomic_t profile_pending = 0;   /* A sample is due at the next step */
+volatile sig_atomic_t profile_requested = 0; /* The profile is written at the next sample */
+source_origin * source_origins[ORIGINCACHE];
+profile_entry * profile_entries[PROFILECACHE];
+int word_effects[RESERVED_WORDS][2] = {
+    /* Values each reserved word pops and pushes, -1 if it can't be known */
+    {1, 0}, {2, 1}, {2, 1}, {2, 1}, {2, 1}, {2, 1}, {2, 1}, {2, 1}, {1, 1},
+    {1, 1}, {1, 1}, {1, 1}, {2, 1}, {2, 1}, {1, 1}, {2, 1}, {2, 1}, {2, 1},
+    {2, 1}, {2, 1}, {2, 1}, {-1, -1}, {2, 0}, {1, 1}, {-1, -1}, {-1, -1},
+    {2, 1}, {1, 0}, {2, 0}, {1, 1}, {2, 1}, {2, 1}, {1, 1}, {1, 1}, {2, 0},
+    {1, 0}, {1, 1}, {1, 0}, {-1, -1}, {3, 1}, {1, 2}, {1, 0}, {2, 2}, {0, 1},
+    {0, 1}, {-1, -1}, {-1, -1}, {1, 0}, {2, 1}, {2, 1}, {1, 0}, {2, 0},
+    {1, 0}, {2, 1}, {-1, -1}, {1, 0}, {-1, -1}, {2, 1}, {2, 1}, {-1, -1},
+    {3, 1}, {-1, -1}, {1, 0}
+};
+char * reserved_words[RESERVED_WORDS] = {
+    "print", "+", "-", "*", "/", "%", "//", "**", "sin", "cos", "tan", "log",
+    "=", "!=", "!", "<", ">", "<=", ">=", "&", "|", "eval", "set", "get",
+    "if", "while", "join", "spawn", "send", "recv", "serve", "connect", "read",
+    "eof", "write", "close", "generator", "yield", "next", "map", "copy", "del",
+    "swap", "input", "random", "exit", "import", "sleep", "after", "every",
+    "cancel", "memo", "seed", "randint", "randints",
+    "unset", "scope", "match", "search", "captures", "gsub",
+    "format", "unsetall"
+};
 
 
 /* --- Function Predefinitions --- */
@@ -62,44 +511,305 @@ void check_args(int argc, char** argv);
 void display_version();
 void display_help();
 char * load_source_file(char* path);
+void load_image(char* path);
+void save_image(char* path);
+void run_jobs();
+void reset_interpreter(bool failed);
+var_element * copy_variables(var_element * original);
+void clear_variables();
 void error(char* message);
 void warning(char* message);
 void eval(char* source, char* base_path);
+void eval_block(code_block * code, char* base_path);
+code_block * compile_block(char* source);
+void tokenize_block(code_block * code);
+void add_token(code_block * code, char* source, size_t from, size_t to, bool is_literal, bool trim);
+int find_word(char* source, size_t from, size_t to);
+void optimize_block(code_block * code);
+void analyze_block(code_block * code);
+bool token_effect(token * current, int * depth, int * needs, int * peak);
+void apply_effect(int * depth, int * needs, int * peak, int block_needs, int block_net, int block_peak);
+void check_stack(code_block * code);
+void reserve_stack(size_t count);
+void remove_tokens(code_block * code, size_t from, size_t count);
+void free_token(token * target);
+void release_block(code_block * code);
+void sweep_compiled_blocks();
+void release_abandoned_blocks();
+unsigned long hash_string(char* source);
+void push_frame(int kind, code_block * code, code_block * alternate, char* base_path, bool owns_base_path);
+void pop_frame();
+int run_frames(frame * stop_at, unsigned int slice);
+int step_frame(frame * current);
+void run_fused(token * fused, char* result_s);
+void apply_fused(token * fused);
+bool test_block(code_block * condition, bool * result);
+void run_tasks();
+bool run_round();
+void wait_for_progress();
+task * spawn_task(char* source, char* base_path);
+channel * get_channel(char* name);
+unsigned long add_timer(char* source, char* base_path, unsigned long delay, bool repeat);
+void cancel_timer(unsigned long id);
+bool fire_timers(unsigned long now);
+bool next_wakeup(unsigned long * wake_at);
+unsigned long new_generator(char* source, char* base_path);
+generator * get_generator(char* handle);
+bool resume_generator(generator * target);
+connection * get_connection(char* handle);
+connection * add_connection(int descriptor);
+connection * new_connection(int descriptor);
+void receive_data(connection * target);
+int take_input();
+void close_connection(connection * target);
+int open_listener(char* port, char* handler, char* base_path);
+int open_connection(char* host, char* port);
+void queue_output(connection * target, char* value);
+void flush_output(connection * target);
+bool poll_connections(int timeout);
+size_t unescape(char* destination, char* source);
+char * copy_string(char* source);
+void * polaris_malloc(size_t size, int category);
+void * polaris_realloc(void * block, size_t size, int category);
+void polaris_free(void * block);
+void account_memory(memory_header * header, int category, size_t size);
+void forget_memory(memory_header * header);
+size_t memory_size(void * block);
+void report_memory();
 void print_substr(char* source, size_t from, size_t to, bool trim);
 bool comp_substr(char* source, size_t from, size_t to, char* compare_to);
 void copy_substr(char* destination, char* origin, size_t from, size_t to);
 void stack_push(char* value, size_t from, size_t to, bool trim, bool pushempty);
-int eval_reserved_word(char* source, size_t token_start, size_t token_end, char* base_path);
+void stack_push_text(char* text);
+stack_element * new_element();
+void push_element(stack_element * element);
+char * take_value(stack_element * se);
+bool str_is_num(char* source, size_t from, size_t to);
+int eval_reserved_word(int word, token * current_token, char* base_path);
+void operate(int word, char* value1, char* value2, char* result_s);
+void operate_function(int word, char* value, char* result_s);
+bool is_arithmetic(int word);
+bool is_integer_text(char* value);
+bool parse_long(char* value, long * result);
+bool operate_integers(int word, char* value1, char* value2, char* result_s);
+bool is_zero_text(char* value);
+int compare_integers(char* value1, char* value2);
+void normalize_integer(char* destination, char* value);
+bool big_from_text(big_integer * target, char* text);
+void big_to_text(big_integer * source, char* destination);
+int big_compare(big_integer * a, big_integer * b);
+bool big_add(big_integer * result, big_integer * a, big_integer * b);
+bool big_multiply(big_integer * result, big_integer * a, big_integer * b);
+void big_divide(big_integer * quotient, big_integer * remainder, big_integer * a, big_integer * b);
+void big_multiply_small(big_integer * result, big_integer * a, int factor);
+bool big_power(big_integer * result, big_integer * base, big_integer * exponent);
+void big_trim(big_integer * target);
+bool is_comparison(int word);
 stack_element * stack_pop();
+stack_element * stack_peek();
 void delete_element(stack_element * se);
 void num_to_str(char* destination, pnumber number);
 void set_var_value(char* var, char* value);
-void get_var_value(char* var);
+void get_var_value(char* var, var_cache * cache);
+var_element * find_var(char* var);
+var_element * lookup_var(char* var, var_cache * cache);
+void assign_var(var_element * target, char* value);
+void unset_var(char* var);
+void unset_prefix(char* prefix);
+void delete_var(var_element * target);
+void delete_scope_variables(unsigned long scope);
+void call_memoized(var_element * function, code_block * body, char* base_path);
+void finish_memoized(frame * current);
+memo_entry * find_memo(char* key, unsigned long hash);
+void forget_memo(memo_entry * entry);
+void forget_function_memos(char* function);
+void map_list(char* list, char* delimiter, char* block, char* base_path);
+#if OS_TYPE == 1
+bool map_in_parallel(char* list, char* delimiter, code_block * code);
+void start_map_workers();
+void * map_helper(void * argument);
+void run_map_elements(map_job * job, map_worker * worker);
+void add_map_memory();
+bool block_is_private(code_block * code);
+void run_private_block(code_block * code, map_worker * worker);
+void run_private_word(int word, map_worker * worker);
+char ** private_top(map_worker * worker, size_t count);
+void private_drop(map_worker * worker, size_t count);
+void private_push(map_worker * worker, char* value);
+void private_push_text(map_worker * worker, char* text, size_t length);
+#endif
+regex * compile_regex(char* pattern);
+void clear_regexes();
+void regex_error(char* pattern, char* message);
+int emit_regex(regex * compiled, int kind, int argument, int target);
+void parse_regex_alternation(regex * compiled, char* pattern, size_t * position);
+void parse_regex_sequence(regex * compiled, char* pattern, size_t * position);
+void parse_regex_atom(regex * compiled, char* pattern, size_t * position);
+void repeat_regex(regex * compiled, int start, int min, int max);
+void copy_regex(regex * compiled, regex_instruction * atom, int size, int start);
+unsigned char * new_regex_class(regex * compiled);
+bool add_regex_escape(unsigned char * members, int escaped);
+int regex_escape_char(int escaped);
+bool run_regex(regex * compiled, char* text, size_t length, size_t start, bool whole, long * found);
+void add_regex_thread(regex * compiled, int * list, long * list_captures, int * count, int start, long * captures, size_t position, size_t length);
+bool regex_accepts(regex * compiled, regex_instruction * instruction, int character);
+void substitute_regex(char* text, regex * compiled, char* replacement);
+char * append_text(char* destination, size_t * length, size_t * capacity, char* text, size_t text_length);
+void format_template(char* template);
+size_t fill_template(char* template, stack_element ** values, char* destination, bool counting);
+void put_text(char* destination, size_t * length, char* text, size_t text_length);
+void resolve_import(char* new_path, char* base_path, char* route);
+void remove_file_name(char* path);
+void translate(char* source, char* path);
+int add_translated_block(code_block * code, int parent, size_t token_index, int nested, char* source, char* base_path, bool function);
+void scan_translated_block(int slot);
+int find_translated_function(char* name);
+int find_translation(int parent, size_t token_index, int nested);
+bool emit_translated_block(int slot, int indent, int end_label);
+void emit_translated_inline(int slot, int indent);
+void emit_translated_string(char* value);
+void emit_indent(int indent);
+code_block * translated_block(char* source);
+code_block * translated_source(char** lines);
+void start_translated();
+void finish_translated();
+void translated_push(token * value);
+void translated_word(token * word, char* base_path);
+void translated_call(token * call, code_block * known, void (*native)(char*), char* base_path);
+bool translated_truth();
+void translated_wait(bool blocked);
 void polaris_setup();
+void seed_random(unsigned long seed);
+unsigned long next_random();
+unsigned long rotate_random(unsigned long value, int bits);
+unsigned long random_below(unsigned long limit);
+pnumber random_fraction();
+pnumber random_integer(pnumber min, pnumber max);
 void polaris_delay(int milliseconds);
+unsigned long polaris_ticks();
+void start_profiler();
+void profile_signal(int number);
+void add_file_origin(char* contents, char* path);
+void add_origin(char* source, char* file, unsigned long line, size_t * breaks, size_t break_count, bool whole_file);
+void locate_tokens(code_block * code, source_origin * origin);
+void take_sample();
+char * describe_frame(char* call_stack, size_t * length, size_t * capacity, frame * current);
+void write_profile();
 
 
 /* --- Main --- */
+#ifndef POLARIS_RUNTIME
+/* Programs translated with -c include this file as their runtime */
 int main(int argc, char** argv){
     char * file_contents = null;
-    check_args(argc, argv);
     polaris_setup();
+    check_args(argc, argv);
+    if(strcmp(image_to_load, "") != 0){
+        load_image(image_to_load);
+    }
     file_contents = load_source_file(filename);
+    if(profiling){
+        start_profiler();
+        add_file_origin(file_contents, filename);
+    }
+    if(translate_program){
+        translate(file_contents, filename);
+        polaris_free(file_contents);
+        return 0;
+    }
     eval(file_contents, ".");
-    if(file_contents != null) free(file_contents);
+    if(file_contents != null) polaris_free(file_contents);
+    if(strcmp(image_to_save, "") != 0){
+        save_image(image_to_save);
+    }
+    if(serve_jobs){
+        run_jobs();
+    }
+    if(stdin_connection != null){
+        /* Input read ahead of the last line is dropped with its buffer */
+        polaris_free((*stdin_connection).inbound);
+        polaris_free(stdin_connection);
+    }
+    if(display_memory_information)
+    {
+        printf("%lu memoized calls answered from the cache, %lu evaluated.\r\n", memo_hits, memo_misses);
+        report_memory();
+    }
     return 0;
 }
+#endif
 
 
 /* --- Functions --- */
 void polaris_setup(){
-    srand(time(null) * clock());
+    program_output = stdout;
+    seed_random((unsigned long)time(null) * 2654435761UL + (unsigned long)clock());
+}
+
+void seed_random(unsigned long seed){
+    /* Spreads one seed over the four words of state with splitmix32, so it is never all zeros */
+    int i;
+    for(i = 0; i < 4; ++i){
+        unsigned long mixed;
+        seed = (seed + 0x9E3779B9UL) & 0xFFFFFFFFUL;
+        mixed = seed;
+        mixed = ((mixed ^ (mixed >> 16)) * 0x85EBCA6BUL) & 0xFFFFFFFFUL;
+        mixed = ((mixed ^ (mixed >> 13)) * 0xC2B2AE35UL) & 0xFFFFFFFFUL;
+        random_state[i] = mixed ^ (mixed >> 16);
+    }
+}
+
+unsigned long rotate_random(unsigned long value, int bits){
+    return ((value << bits) | (value >> (32 - bits))) & 0xFFFFFFFFUL;
+}
+
+unsigned long next_random(){
+    /* Next 32 bits of xoshiro128**, kept in unsigned long since C89 has no exact 32-bit type */
+    unsigned long result = (rotate_random((random_state[1] * 5) & 0xFFFFFFFFUL, 7) * 9) & 0xFFFFFFFFUL;
+    unsigned long shifted = (random_state[1] << 9) & 0xFFFFFFFFUL;
+    random_state[2] ^= random_state[0];
+    random_state[3] ^= random_state[1];
+    random_state[1] ^= random_state[2];
+    random_state[0] ^= random_state[3];
+    random_state[2] ^= shifted;
+    random_state[3] = rotate_random(random_state[3], 11);
+    return result;
+}
+
+unsigned long random_below(unsigned long limit){
+    /* Uniform value in [0, limit), rejecting the few values that would favour the low ones */
+    unsigned long threshold = (0xFFFFFFFFUL % limit + 1) % limit;
+    unsigned long value;
+    do{
+        value = next_random();
+    }while(value < threshold);
+    return value % limit;
+}
+
+pnumber random_fraction(){
+    /* Uniform value in [0, 1) with the 53 bits a double can hold */
+    pnumber high = (pnumber)(next_random() >> 5);
+    pnumber low = (pnumber)(next_random() >> 6);
+    return (high * 67108864.0 + low) / 9007199254740992.0;
+}
+
+pnumber random_integer(pnumber min, pnumber max){
+    /* Same values as "max min - random * 1 // min +", without the bias for integer ranges */
+    pnumber span = max - min;
+    pnumber size = span < 0 ? -span : span;
+    if(size >= 1 && size == floor(size) && size <= 4294967296.0){
+        pnumber offset = size == 4294967296.0 ? (pnumber)next_random() : (pnumber)random_below((unsigned long)size);
+        return span < 0 ? min - offset : min + offset;
+    }
+    return min + (pnumber_i)(random_fraction() * span);
 }
 
 void check_args(int argc, char** argv){
     strcpy(filename, "");
+    strcpy(image_to_load, "");
+    strcpy(image_to_save, "");
     if(argc > 1) {
-        unsigned int i;
+        int i;
         for(i = 1; i < argc; ++i){
             #if OS_TYPE == 1
             if(strcmp(argv[i], "-v") == 0){
@@ -114,6 +824,22 @@ void check_args(int argc, char** argv){
             else if(strcmp(argv[i], "-p") == 0){
                 show_pushpops = true;
             }
+            else if(strcmp(argv[i], "-c") == 0){
+                translate_program = true;
+            }
+            else if(strcmp(argv[i], "-i") == 0 && i < argc - 1){
+                strcpy(image_to_load, argv[++i]);
+            }
+            else if(strcmp(argv[i], "-s") == 0 && i < argc - 1){
+                strcpy(image_to_save, argv[++i]);
+            }
+            else if(strcmp(argv[i], "-j") == 0){
+                serve_jobs = true;
+            }
+            else if(strcmp(argv[i], "-f") == 0 && i < argc - 1){
+                strcpy(profile_to_write, argv[++i]);
+                profiling = true;
+            }
             #elif OS_TYPE == 2 || OS_TYPE == 3
             if(strcmp(argv[i], "/v") == 0){
                 display_version();
@@ -127,6 +853,22 @@ void check_args(int argc, char** argv){
             else if(strcmp(argv[i], "/p") == 0){
                 show_pushpops = true;
             }
+            else if(strcmp(argv[i], "/c") == 0){
+                translate_program = true;
+            }
+            else if(strcmp(argv[i], "/i") == 0 && i < argc - 1){
+                strcpy(image_to_load, argv[++i]);
+            }
+            else if(strcmp(argv[i], "/s") == 0 && i < argc - 1){
+                strcpy(image_to_save, argv[++i]);
+            }
+            else if(strcmp(argv[i], "/j") == 0){
+                serve_jobs = true;
+            }
+            else if(strcmp(argv[i], "/f") == 0 && i < argc - 1){
+                strcpy(profile_to_write, argv[++i]);
+                profiling = true;
+            }
             #endif
             else{
                 strcpy(filename, argv[i]);
@@ -140,6 +882,12 @@ void check_args(int argc, char** argv){
     if(strcmp(filename, "") == 0){
         error("\r\nUsage: polaris <file>\r\nRun polaris -h for more information");
     }
+    if(translate_program){
+        /* Translated code relies on blocks compiling the same way at run time */
+        show_pushpops = false;
+        display_memory_information = false;
+        profiling = false;
+    }
 }
 
 void display_version()
@@ -159,6 +907,11 @@ void display_help()
     puts("  -h              Display this help.");
     puts("  -m              Display memory information.");
     puts("  -p              Show push and pops during execution.");
+    puts("  -c              Translate the program to C instead of running it.");
+    puts("  -i <image>      Start with the variables saved in an image.");
+    puts("  -s <image>      Save the variables to an image after running.");
+    puts("  -j              Run the program, then a job for every file named on stdin.");
+    puts("  -f <profile>    Sample where the program spends its time into a profile.");
     puts("Complete documentation for Polaris should be found on this");
     puts("system using the 'man polaris' command. If you have access");
     puts("to the internet, the documentation can also be found online");
@@ -168,6 +921,11 @@ void display_help()
     puts("  /h              Display this help.");
     puts("  /m              Display memory information.");
     puts("  /p              Show push and pops during execution.");
+    puts("  /c              Translate the program to C instead of running it.");
+    puts("  /i <image>      Start with the variables saved in an image.");
+    puts("  /s <image>      Save the variables to an image after running.");
+    puts("  /j              Run the program, then a job for every file named on stdin.");
+    puts("  /f <profile>    Sample where the program spends its time into a profile.");
     puts("Complete documentation for Polaris should be found under");
     puts("the Polaris directory on this system. If you have access");
     puts("to the internet, the documentation can also be found online");
@@ -185,7 +943,7 @@ char * load_source_file(char* path)
     size_t file_length = 0;
      if(display_memory_information)
     {
-        printf("Loading file %s...\r\n", path);
+        fprintf(program_output, "Loading file %s...\r\n", path);
     }
     file_pointer = fopen(path, "r");
     if(file_pointer)
@@ -200,17 +958,18 @@ char * load_source_file(char* path)
         /* Declare file buffer */
         file_size = sizeof(char) * (file_length + 1);
             /* That +1 is because I may sometimes want to access two characters at a time. */
-        file_contents = malloc(file_size);
+        file_contents = polaris_malloc(file_size, MEMORY_STRINGS);
         if(display_memory_information)
         {
-            printf("%lu bytes allocated for source file.\r\n", (unsigned long)file_size);
+            fprintf(program_output, "%lu bytes allocated for source file.\r\n", (unsigned long)file_size);
         }
         /* Load file */
         fseek(file_pointer, 0, SEEK_SET);
         bytes_read = fread(file_contents, 1, file_size, file_pointer);
+        file_contents[bytes_read] = '\0';
         if(display_memory_information)
         {
-            printf("%lu bytes read from source file.\r\n", (unsigned long)bytes_read);
+            fprintf(program_output, "%lu bytes read from source file.\r\n", (unsigned long)bytes_read);
         }
         fclose(file_pointer);
         return file_contents;
@@ -222,33 +981,380 @@ char * load_source_file(char* path)
     return null;
 }
 
+void load_image(char* path)
+{
+    /* Restores the variables saved by save_image. The whole image is read
+       at once, each variable is a line with the length of its name, the
+       length of its value and its number of memoized inputs, followed by
+       the name and the value. */
+    FILE* file_pointer = fopen(path, "rb");
+    char * image;
+    char * position;
+    char * end;
+    long image_size;
+    unsigned long image_variables;
+    unsigned long i;
+    if(!file_pointer){
+        error("couldn't load the requested image.");
+    }
+    fseek(file_pointer, 0, SEEK_END);
+    image_size = ftell(file_pointer);
+    if(image_size < 0){
+        fclose(file_pointer);
+        error("couldn't load the requested image.");
+    }
+    fseek(file_pointer, 0, SEEK_SET);
+    image = polaris_malloc(sizeof(char) * (image_size + 1), MEMORY_STRINGS);
+    if(fread(image, 1, image_size, file_pointer) != (size_t)image_size){
+        fclose(file_pointer);
+        polaris_free(image);
+        error("couldn't load the requested image.");
+    }
+    fclose(file_pointer);
+    image[image_size] = '\0';
+    end = image + image_size;
+    if(strncmp(image, IMAGEHEADER, strlen(IMAGEHEADER)) != 0){
+        error("the requested file is not a Polaris image.");
+    }
+    position = image + strlen(IMAGEHEADER);
+    image_variables = strtoul(position, &position, 10);
+    for(i = 0; i < image_variables; ++i){
+        unsigned long name_length = strtoul(position, &position, 10);
+        unsigned long value_length = strtoul(position, &position, 10);
+        long memo_inputs = strtol(position, &position, 10);
+        char * name;
+        char * value;
+        if(*position != '\n' || (unsigned long)(end - position - 1) < name_length + value_length){
+            error("the requested image is damaged.");
+        }
+        position++;
+        name = polaris_malloc(sizeof(char) * (name_length + 1), MEMORY_STRINGS);
+        memcpy(name, position, name_length);
+        name[name_length] = '\0';
+        position += name_length;
+        value = polaris_malloc(sizeof(char) * (value_length + 1), MEMORY_STRINGS);
+        memcpy(value, position, value_length);
+        value[value_length] = '\0';
+        position += value_length;
+        set_var_value(name, value);
+        (*find_var(name)).memo_inputs = (int)memo_inputs;
+        polaris_free(name);
+        polaris_free(value);
+    }
+    if(display_memory_information)
+    {
+        printf("%lu variables loaded from image %s (%ld bytes).\r\n", image_variables, path, image_size);
+    }
+    polaris_free(image);
+}
+
+void save_image(char* path)
+{
+    /* Saves every variable so a later run can start from them with -i.
+       Variables are saved oldest first so they are loaded in the same order. */
+    FILE* file_pointer = fopen(path, "wb");
+    var_element ** saved;
+    var_element * current_var;
+    unsigned long image_variables = 0;
+    unsigned long i;
+    if(!file_pointer){
+        error("couldn't save the image.");
+    }
+    for(current_var = variables; current_var != null; current_var = (*current_var).next){
+        image_variables++;
+    }
+    saved = polaris_malloc(sizeof(var_element *) * (image_variables + 1), MEMORY_VARIABLES);
+    i = image_variables;
+    for(current_var = variables; current_var != null; current_var = (*current_var).next){
+        saved[--i] = current_var;
+    }
+    fprintf(file_pointer, "%s%lu\n", IMAGEHEADER, image_variables);
+    for(i = 0; i < image_variables; ++i){
+        fprintf(file_pointer, "%lu %lu %d\n", (unsigned long)strlen((*saved[i]).name),
+            (unsigned long)strlen((*saved[i]).value), (*saved[i]).memo_inputs);
+        fputs((*saved[i]).name, file_pointer);
+        fputs((*saved[i]).value, file_pointer);
+    }
+    polaris_free(saved);
+    if(fclose(file_pointer) != 0){
+        error("couldn't save the image.");
+    }
+    if(display_memory_information)
+    {
+        printf("%lu variables saved to image %s.\r\n", image_variables, path);
+    }
+}
+
+void run_jobs()
+{
+    /* Runs a job for every file named on stdin, one per line. Each job
+       starts from the variables the main program left and runs on a clean
+       interpreter. Its output is written after a line with the job number,
+       "finished" or "failed", the milliseconds it took, the number of bytes
+       of output that follow and the file name. */
+    var_element * base_variables = copy_variables(variables);
+    size_t base_variable_count = variable_count;
+    char path[MAXINPUTLENGTH + 1];
+    unsigned long job_number = 0;
+    reset_interpreter(false);
+    while(fgets(path, MAXINPUTLENGTH, stdin) != null){
+        FILE * job_output;
+        unsigned long started;
+        unsigned long elapsed;
+        long output_length;
+        bool failed;
+        path[strcspn(path, "\r\n")] = '\0';
+        if(strlen(path) == 0){
+            continue;
+        }
+        job_number++;
+        job_output = tmpfile();
+        if(job_output == null){
+            error("couldn't create a temporary file for the output of a job.");
+        }
+        program_output = job_output;
+        started = polaris_ticks();
+        running_jobs = true;
+        if(setjmp(job_failure) == 0){
+            job_source = load_source_file(path);
+            eval(job_source, ".");
+            failed = false;
+        }else{
+            failed = true;
+        }
+        running_jobs = false;
+        elapsed = polaris_ticks() - started;
+        program_output = stdout;
+        if(job_source != null){
+            polaris_free(job_source);
+            job_source = null;
+        }
+        reset_interpreter(failed);
+        clear_variables();
+        if(failed){
+            release_abandoned_blocks();
+        }
+        variables = copy_variables(base_variables);
+        variable_count = base_variable_count;
+        /* Send the output */
+        output_length = ftell(job_output);
+        printf("%lu %s %lu %ld %s\n", job_number, failed ? "failed" : "finished", elapsed, output_length, path);
+        rewind(job_output);
+        while(output_length > 0){
+            char buffer[SOCKETBUFFER];
+            size_t bytes_read = fread(buffer, 1, output_length < SOCKETBUFFER ? output_length : SOCKETBUFFER, job_output);
+            if(bytes_read == 0) break;
+            fwrite(buffer, 1, bytes_read, stdout);
+            output_length -= bytes_read;
+        }
+        fclose(job_output);
+        fflush(stdout);
+    }
+}
+
+void reset_interpreter(bool failed)
+{
+    /* Discards everything a job left behind. When a job fails in the
+       middle of running, its frames and stacks may be half updated, so they
+       are abandoned instead of freed, and the references they hold on
+       compiled blocks are dropped by release_abandoned_blocks. */
+    int descriptor;
+    for(descriptor = 0; descriptor < connection_table_size; ++descriptor){
+        if(connection_table[descriptor] != null){
+            (*connection_table[descriptor]).outbound_length = 0;
+            close_connection(connection_table[descriptor]);
+        }
+    }
+    while(timers != null){
+        cancel_timer((*timers).id);
+    }
+    while(generators != null){
+        generator * discarded = generators;
+        generators = (*discarded).next;
+        if(!failed){
+            frames = (*discarded).frames;
+            while(frames != null){
+                pop_frame();
+            }
+            stack = (*discarded).stack;
+            while(stack != null){
+                stack_element * value = stack;
+                stack = (*value).next;
+                delete_element(value);
+            }
+            if((*discarded).yielded != null) delete_element((*discarded).yielded);
+            polaris_free(discarded);
+        }
+    }
+    while(!failed && stack != null){
+        stack_element * value = stack;
+        stack = (*value).next;
+        delete_element(value);
+    }
+    while(newest_memo != null){
+        forget_memo(newest_memo);
+    }
+    tasks = null;
+    frames = null;
+    stack = null;
+    current_task = null;
+    main_task = null;
+    main_running = false;
+    current_generator = null;
+    nested_evaluations = 0;
+}
+
+var_element * copy_variables(var_element * original)
+{
+    /* Copies a list of variables, keeping their order */
+    var_element * copied = null;
+    var_element ** last = &copied;
+    while(original != null){
+        var_element * new_var = polaris_malloc(sizeof(var_element), MEMORY_VARIABLES);
+        (*new_var).name = copy_string((*original).name);
+        (*new_var).value = copy_string((*original).value);
+        (*new_var).code = null;
+        (*new_var).memo_inputs = (*original).memo_inputs;
+        (*new_var).scope = (*original).scope;
+        *last = new_var;
+        last = &(*new_var).next;
+        original = (*original).next;
+    }
+    *last = null;
+    return copied;
+}
+
+void clear_variables()
+{
+    /* Deletes every variable */
+    while(variables != null){
+        var_element * deleted = variables;
+        variables = (*deleted).next;
+        if((*deleted).code != null) release_block((*deleted).code);
+        polaris_free((*deleted).name);
+        polaris_free((*deleted).value);
+        polaris_free(deleted);
+    }
+    while(free_variables != null){
+        var_element * deleted = free_variables;
+        free_variables = (*deleted).next;
+        polaris_free((*deleted).name);
+        polaris_free(deleted);
+    }
+    variable_count = 0;
+    free_variable_count = 0;
+    variables_generation++;
+}
+
 void error(char* message)
 {
-    printf("Polaris error: %s\r\n", message);
+    #if OS_TYPE == 1
+        if(map_running){
+            /* The element fails without a word, the map is run again in
+               order and reports it then */
+            map_worker * worker = pthread_getspecific(map_worker_key);
+            if(worker != null) longjmp((*worker).failure, 1);
+        }
+    #endif
+    fprintf(program_output, "Polaris error: %s\r\n", message);
     /*if(file_contents != null) free(file_contents);*/
+    if(running_jobs){
+        /* Only the job fails */
+        longjmp(job_failure, 1);
+    }
     exit(1);
 }
 
 void warning(char* message)
 {
-    printf("Polaris warning: %s\r\n", message);
+    fprintf(program_output, "Polaris warning: %s\r\n", message);
 }
 
 void eval(char* source, char* base_path)
 {
+    eval_block(compile_block(source), base_path);
+}
+
+void eval_block(code_block * code, char* base_path)
+{
+    /* Evaluates code and returns once it has finished. When no task is
+       running yet, code becomes the main task and every task it spawns is
+       run before returning. */
+    frame * caller = frames;
+    push_frame(FRAME_EVAL, code, null, base_path, false);
+    if(current_task == null){
+        run_tasks();
+    }else{
+        nested_evaluations++;
+        if(run_frames(caller, 0) == RUN_WAITING){
+            error("cannot wait on a channel from inside a nested evaluation.");
+        }
+        nested_evaluations--;
+    }
+}
+
+code_block * compile_block(char* source)
+{
+    /* Returns the compiled form of source. Blocks are only compiled the
+       first time they are seen, after that they come from the cache. */
+    unsigned long hash = hash_string(source);
+    code_block * code = compiled_blocks[hash % COMPILECACHE];
+    while(code != null){
+        if((*code).hash == hash && strcmp((*code).source, source) == 0){
+            return code;
+        }
+        code = (*code).next;
+    }
+    if(compiled_block_count >= COMPILECACHE){
+        sweep_compiled_blocks();
+    }
+    code = polaris_malloc(sizeof(code_block), MEMORY_CODE);
+    (*code).source = copy_string(source);
+    (*code).hash = hash;
+    (*code).tokens = null;
+    (*code).token_count = 0;
+    (*code).references = 0;
+    (*code).file = null;
+    (*code).name = null;
+    tokenize_block(code);
+    if(profiling){
+        source_origin * origin = source_origins[hash % ORIGINCACHE];
+        while(origin != null && ((*origin).hash != hash || strcmp((*origin).source, source) != 0)){
+            origin = (*origin).next;
+        }
+        if(origin != null){
+            (*code).file = (*origin).file;
+            locate_tokens(code, origin);
+        }
+    }
+    if(!show_pushpops){
+        /* -p shows every push and pop, so the code is left as written */
+        optimize_block(code);
+    }
+    analyze_block(code);
+    (*code).next = compiled_blocks[hash % COMPILECACHE];
+    compiled_blocks[hash % COMPILECACHE] = code;
+    compiled_block_count++;
+    return code;
+}
+
+void tokenize_block(code_block * code)
+{
+    /* Splits the source of a block into tokens */
+    char * source = (*code).source;
     size_t token_start = 0;
     size_t token_end;
     size_t code_length = strlen(source)+1;
     bool in_comment = false;
     unsigned int in_block_level = 0;
     bool in_quoted = false;
-    /* Find and evaluate tokens */
+    /* Find tokens */
     char current_char;
     char next_char;
     size_t i;
     for(i = 0; i < code_length; ++i){
         current_char = source[i];
-        next_char = source[i + 1];
+        next_char = i + 1 < code_length ? source[i + 1] : '\0';
         if(!in_quoted && current_char == '/' && next_char == '*')
         {
             in_comment = true;
@@ -276,7 +1382,7 @@ void eval(char* source, char* base_path)
             in_block_level--;
             token_end = i+1;
             if(in_block_level == 0 && token_start < token_end){
-                stack_push(source, token_start+1, token_end-1, true, true);
+                add_token(code, source, token_start+1, token_end-1, true, true);
                 token_start = i+1;
             }
         }
@@ -290,7 +1396,7 @@ void eval(char* source, char* base_path)
             in_quoted = false;
             token_end = i+1;
             if(token_start < token_end){
-                stack_push(source, token_start+1, token_end-1, false, true);
+                add_token(code, source, token_start+1, token_end-1, true, false);
             }
             token_start = i+1;
         }
@@ -300,707 +1406,4414 @@ void eval(char* source, char* base_path)
         {
             token_end = i;
             if(token_start < token_end){
-                /* Acá evalúo el token */
-                if(eval_reserved_word(source, token_start, token_end, base_path) != 0){
-                    return;
-                }
+                add_token(code, source, token_start, token_end, false, true);
             }
             token_start = i;
         }
     }
 }
 
-bool str_is_num(char* source, size_t from, size_t to){
-    bool already_found_sign = false;
-    bool already_found_point = false;
-    size_t numbers_before_point = 0;
-    size_t numbers_after_point = 0;
+void add_token(code_block * code, char* source, size_t from, size_t to, bool is_literal, bool trim)
+{
+    /* Appends a token to a block. Literals (blocks and quoted strings) are
+       pushed as they are, any other token is looked up as a word. */
+    token * new_token;
     size_t i;
-    for(i = from; i < to; ++i){
-        if(!already_found_sign && source[i] == '-'){
-            already_found_sign = true;
+    if(trim){
+        /* Find real start (trim) */
+        for(i = from; i < to; ++i){
+            if(source[i] == ' ' || source[i] == '\n' || source[i] == '\t'){
+                from++;
+            }else{
+                break;
+            }
         }
-        else if(!already_found_point && source[i] == '.'){
-            already_found_point = true;
-        }else if(
-            source[i] == '0' || source[i] == '1' 
-            || source[i] == '2' || source[i] == '3'
-            || source[i] == '4' || source[i] == '5'
-            || source[i] == '6' || source[i] == '7'
-            || source[i] == '8' || source[i] == '9'
-            )
-        {
-            already_found_sign = true;
-            if(already_found_point){
-                numbers_after_point++;
+        /* Find real end (trim) */
+        for(i = to; i > from; --i){
+            if(source[i-1] == ' ' || source[i-1] == '\n' || source[i-1] == '\t'){
+                to--;
             }else{
-                numbers_before_point++;
+                break;
             }
-        }else{
-            return false;
         }
     }
-    if(numbers_before_point == 0){
-        return false;
-    }
-    if(already_found_point && numbers_after_point == 0){
-        return false;
+    if(!is_literal && from >= to){
+        /* Only blocks and quoted strings can be empty */
+        return;
     }
-    return true;
-}
-
-int eval_reserved_word(char* source, size_t token_start, size_t token_end, char* base_path){
-    /* Find real start (trim) */
-    size_t i;
-    for(i = token_start; i < token_end; ++i){
-        if(source[i] == ' ' || source[i] == '\n' || source[i] == '\t'){
-            token_start++;
-        }else{
-            break;
+    (*code).tokens = polaris_realloc((*code).tokens, sizeof(token) * ((*code).token_count + 1), MEMORY_CODE);
+    new_token = &(*code).tokens[(*code).token_count];
+    (*code).token_count++;
+    (*new_token).kind = TOKEN_PUSH;
+    (*new_token).word = WORD_STRING;
+    (*new_token).text = null;
+    (*new_token).target = null;
+    (*new_token).operations = null;
+    (*new_token).operands = null;
+    (*new_token).operation_count = 0;
+    (*new_token).blocks[0] = null;
+    (*new_token).blocks[1] = null;
+    (*new_token).blocks[2] = null;
+    (*new_token).variable.var = null;
+    (*new_token).target_variable.var = null;
+    (*new_token).offset = from;
+    (*new_token).line = 0;
+    if(!is_literal){
+        (*new_token).word = find_word(source, from, to);
+        if((*new_token).word == WORD_SET_VAR || (*new_token).word == WORD_GET_VAR){
+            from++;
+        }else if((*new_token).word == WORD_CALL){
+            to--;
         }
     }
-    /* Find real end (trim) */
-    for(i = token_end-1; i >= token_start; --i){
-        if(source[i] == ' ' || source[i] == '\n' || source[i] == '\t'){
-            token_end--;
+    (*new_token).text = polaris_malloc(sizeof(char) * (to - from + 1), MEMORY_CODE);
+    copy_substr((*new_token).text, source, from, to);
+    if((*new_token).word == WORD_NUMBER){
+        char result_s[NUMBERLENGTH];
+        if(is_integer_text((*new_token).text) && strlen((*new_token).text) <= BIGLIMBS * 4){
+            normalize_integer(result_s, (*new_token).text);
         }else{
-            break;
+            num_to_str(result_s, atof((*new_token).text));
         }
+        polaris_free((*new_token).text);
+        (*new_token).text = copy_string(result_s);
+    }else if((*new_token).word < WORD_NUMBER){
+        (*new_token).kind = TOKEN_WORD;
     }
-    /* print */
-    if(comp_substr(source, token_start, token_end, "print")){
-        stack_element * value = stack_pop();
-        size_t val_len = strlen((*value).value);
-        source = (*value).value;
-        for(i = 0; i < val_len; ++i){
-            if(source[i] == '\\' && i < val_len && source[i+1] == 'n'){
-                printf("\n");
-                ++i;
-            }else if(source[i] == '\\' && i < val_len && source[i+1] == 'r'){
-                printf("\r");
-                ++i;
-            }else if(source[i] == '\\' && i < val_len && source[i+1] == 't'){
-                printf("\t");
-                ++i;
-            }else if(source[i] == '\\' && i < val_len && source[i+1] == 'b'){
-                printf("\b");
-                ++i;
-            }else if(source[i] == '\\' && i < val_len && source[i+1] == 'a'){
-                printf("\a");
-                ++i;
-            }else if(source[i] == '\\' && i < val_len && source[i+1] == 'v'){
-                printf("\v");
-                ++i;
-            }else if(source[i] == '\\' && i < val_len && source[i+1] == 'f'){
-                printf("\f");
-                ++i;
-            }else if(source[i] == '\\' && i < val_len && source[i+1] == '\\'){
-                printf("\\");
-                ++i;
-            }else if(source[i] == '\\' && i < val_len && source[i+1] == '"'){
-                printf("\"");
-                ++i;
-            }else{
-                printf("%c", source[i]);
-            }
+}
+
+int find_word(char* source, size_t from, size_t to)
+{
+    /* Tells what a (trimmed) token is */
+    int word;
+    for(word = 0; word < RESERVED_WORDS; ++word){
+        if(comp_substr(source, from, to, reserved_words[word])){
+            return word;
         }
-        #if OS_TYPE == 1
-            fflush(stdout);
-        #endif
-        delete_element(value);
     }
-    /* + */
-    else if(comp_substr(source, token_start, token_end, "+")){
-        stack_element * value2 = stack_pop();
-        stack_element * value1 = stack_pop();
-        pnumber result;
-        char result_s[50];
+    if(comp_substr(source, from, from + 1, ">")) return WORD_SET_VAR;
+    if(comp_substr(source, from, from + 1, "@")) return WORD_GET_VAR;
+    if(comp_substr(source, to - 1, to, "%")) return WORD_CALL;
+    if(str_is_num(source, from, to)) return WORD_NUMBER;
+    return WORD_STRING;
+}
+
+void optimize_block(code_block * code)
+{
+    /* Folds operations on constants, turns if and while with literal blocks
+       into single tokens and fuses variable operations like @n 1 + >n */
+    token * tokens;
+    size_t i;
+    /* Constant folding */
+    for(i = 0; i + 2 < (*code).token_count; ++i){
+        tokens = (*code).tokens;
         if(
-            !str_is_num((*value1).value, 0, strlen((*value1).value))
-            || !str_is_num((*value2).value, 0, strlen((*value2).value))
+            tokens[i].kind == TOKEN_PUSH && tokens[i+1].kind == TOKEN_PUSH
+            && tokens[i+2].kind == TOKEN_WORD
+            && (
+                is_comparison(tokens[i+2].word)
+                || (
+                    is_arithmetic(tokens[i+2].word)
+                    && str_is_num(tokens[i].text, 0, strlen(tokens[i].text))
+                    && str_is_num(tokens[i+1].text, 0, strlen(tokens[i+1].text))
+                    /* Integer division by zero is left to fail when (if) it runs */
+                    && !(
+                        (tokens[i+2].word == WORD_MODULO || tokens[i+2].word == WORD_DIVIDE_INT)
+                        && (pnumber_i)atof(tokens[i+1].text) == 0
+                    )
+                )
+            )
         ){
-            error("trying to operate arithmetically with a non-numerical value.");
+            char result_s[NUMBERLENGTH];
+            operate(tokens[i+2].word, tokens[i].text, tokens[i+1].text, result_s);
+            polaris_free(tokens[i].text);
+            tokens[i].text = copy_string(result_s);
+            tokens[i].word = WORD_NUMBER;
+            remove_tokens(code, i+1, 2);
+            /* The result may fold with what comes before it */
+            i = i >= 2 ? i - 2 : (size_t)-1;
         }
-        result = atof((*value1).value) + atof((*value2).value);
-        num_to_str(result_s, result);
-        delete_element(value2);
-        delete_element(value1);
-        stack_push(result_s, 0, 50, true, false);
     }
-    /* - */
-    else if(comp_substr(source, token_start, token_end, "-")){
-        stack_element * value2 = stack_pop();
-        stack_element * value1 = stack_pop();
-        pnumber result;
-        char result_s[50];
+    /* if and while with literal blocks */
+    for(i = 0; i < (*code).token_count; ++i){
+        tokens = (*code).tokens;
         if(
-            !str_is_num((*value1).value, 0, strlen((*value1).value))
-            || !str_is_num((*value2).value, 0, strlen((*value2).value))
+            i + 3 < (*code).token_count
+            && tokens[i].kind == TOKEN_PUSH && tokens[i+1].kind == TOKEN_PUSH
+            && tokens[i+2].kind == TOKEN_PUSH
+            && tokens[i+3].kind == TOKEN_WORD && tokens[i+3].word == WORD_IF
         ){
-            error("trying to operate arithmetically with a non-numerical value.");
+            code_block * blocks[3];
+            blocks[0] = compile_block(tokens[i].text);
+            (*blocks[0]).references++;
+            blocks[1] = compile_block(tokens[i+1].text);
+            (*blocks[1]).references++;
+            blocks[2] = compile_block(tokens[i+2].text);
+            (*blocks[2]).references++;
+            tokens = (*code).tokens;
+            remove_tokens(code, i+1, 3);
+            polaris_free(tokens[i].text);
+            tokens[i].text = null;
+            tokens[i].kind = TOKEN_IF;
+            tokens[i].word = WORD_IF;
+            tokens[i].blocks[0] = blocks[0];
+            tokens[i].blocks[1] = blocks[1];
+            tokens[i].blocks[2] = blocks[2];
         }
-        result = atof((*value1).value) - atof((*value2).value);
-        num_to_str(result_s, result);
-        delete_element(value2);
-        delete_element(value1);
-        stack_push(result_s, 0, 50, true, false);
-    }
-    /* * */
-    else if(comp_substr(source, token_start, token_end, "*")){
-        stack_element * value2 = stack_pop();
-        stack_element * value1 = stack_pop();
-        pnumber result;
-        char result_s[50];
-        if(
-            !str_is_num((*value1).value, 0, strlen((*value1).value))
-            || !str_is_num((*value2).value, 0, strlen((*value2).value))
+        else if(
+            i + 2 < (*code).token_count
+            && tokens[i].kind == TOKEN_PUSH && tokens[i+1].kind == TOKEN_PUSH
+            && tokens[i+2].kind == TOKEN_WORD && tokens[i+2].word == WORD_WHILE
         ){
-            error("trying to operate arithmetically with a non-numerical value.");
+            code_block * blocks[2];
+            blocks[0] = compile_block(tokens[i].text);
+            (*blocks[0]).references++;
+            blocks[1] = compile_block(tokens[i+1].text);
+            (*blocks[1]).references++;
+            tokens = (*code).tokens;
+            remove_tokens(code, i+1, 2);
+            polaris_free(tokens[i].text);
+            tokens[i].text = null;
+            tokens[i].kind = TOKEN_WHILE;
+            tokens[i].word = WORD_WHILE;
+            tokens[i].blocks[0] = blocks[0];
+            tokens[i].blocks[1] = blocks[1];
         }
-        result = atof((*value1).value) * atof((*value2).value);
-        num_to_str(result_s, result);
-        delete_element(value2);
-        delete_element(value1);
-        stack_push(result_s, 0, 50, true, false);
     }
-    /* / */
-    else if(comp_substr(source, token_start, token_end, "/")){
-        stack_element * value2 = stack_pop();
-        stack_element * value1 = stack_pop();
-        pnumber result;
-        char result_s[50];
-        if(
-            !str_is_num((*value1).value, 0, strlen((*value1).value))
-            || !str_is_num((*value2).value, 0, strlen((*value2).value))
+    /* @var followed by operations with constants, optionally ending in >var */
+    for(i = 0; i < (*code).token_count; ++i){
+        size_t j = i + 1;
+        tokens = (*code).tokens;
+        if(tokens[i].kind != TOKEN_WORD || tokens[i].word != WORD_GET_VAR){
+            continue;
+        }
+        while(
+            j + 1 < (*code).token_count
+            && tokens[j].kind == TOKEN_PUSH && tokens[j+1].kind == TOKEN_WORD
+            && (is_arithmetic(tokens[j+1].word) || is_comparison(tokens[j+1].word))
         ){
-            error("trying to operate arithmetically with a non-numerical value.");
+            tokens[i].operations = polaris_realloc(tokens[i].operations, sizeof(int) * (tokens[i].operation_count + 1), MEMORY_CODE);
+            tokens[i].operands = polaris_realloc(tokens[i].operands, sizeof(char *) * (tokens[i].operation_count + 1), MEMORY_CODE);
+            tokens[i].operations[tokens[i].operation_count] = tokens[j+1].word;
+            tokens[i].operands[tokens[i].operation_count] = tokens[j].text;
+            tokens[i].operation_count++;
+            tokens[j].text = null;
+            j += 2;
         }
-        result = atof((*value1).value) / atof((*value2).value);
-        num_to_str(result_s, result);
-        delete_element(value2);
-        delete_element(value1);
-        stack_push(result_s, 0, 50, true, false);
-    }
-    /* % */
-    else if(comp_substr(source, token_start, token_end, "%")){
-        stack_element * value2 = stack_pop();
-        stack_element * value1 = stack_pop();
-        pnumber result;
-        char result_s[50];
-        if(
-            !str_is_num((*value1).value, 0, strlen((*value1).value))
-            || !str_is_num((*value2).value, 0, strlen((*value2).value))
-        ){
-            error("trying to operate arithmetically with a non-numerical value.");
+        if(tokens[i].operation_count == 0){
+            continue;
         }
-        result = (pnumber_i)atof((*value1).value) % (pnumber_i)atof((*value2).value);
-        num_to_str(result_s, result);
-        delete_element(value2);
-        delete_element(value1);
-        stack_push(result_s, 0, 50, true, false);
-    }
-    /* // */
-    else if(comp_substr(source, token_start, token_end, "//")){
-        stack_element * value2 = stack_pop();
-        stack_element * value1 = stack_pop();
-        char result_s[50];
-        pnumber result;
-        if(
-            !str_is_num((*value1).value, 0, strlen((*value1).value))
-            || !str_is_num((*value2).value, 0, strlen((*value2).value))
-        ){
-            error("trying to operate arithmetically with a non-numerical value.");
+        if(j < (*code).token_count && tokens[j].kind == TOKEN_WORD && tokens[j].word == WORD_SET_VAR){
+            tokens[i].target = tokens[j].text;
+            tokens[j].text = null;
+            j++;
         }
-        result = (pnumber_i)(atof((*value1).value) / atof((*value2).value));
-        num_to_str(result_s, result);
-        delete_element(value2);
-        delete_element(value1);
-        stack_push(result_s, 0, 50, true, false);
+        tokens[i].kind = TOKEN_FUSED;
+        remove_tokens(code, i+1, j - i - 1);
     }
-    /* ** */
-    else if(comp_substr(source, token_start, token_end, "**")){
-        stack_element * value2 = stack_pop();
-        stack_element * value1 = stack_pop();
-        pnumber result;
-        char result_s[50];
-        if(
-            !str_is_num((*value1).value, 0, strlen((*value1).value))
-            || !str_is_num((*value2).value, 0, strlen((*value2).value))
-        ){
-            error("trying to operate arithmetically with a non-numerical value.");
+}
+
+void analyze_block(code_block * code)
+{
+    /* Works out the stack effect of a block from the effects of its
+       tokens. Analysis stops at the first token whose effect can't be known
+       before running it, like eval, a call or an if; needs and peak still
+       hold for the tokens before it, as those always run. */
+    int depth = 0;
+    int needs = 0;
+    int peak = 0;
+    size_t i;
+    for(i = 0; i < (*code).token_count; ++i){
+        if(!token_effect(&(*code).tokens[i], &depth, &needs, &peak)){
+            break;
         }
-        result = pow(atof((*value1).value), atof((*value2).value));
-        num_to_str(result_s, result);
-        delete_element(value2);
-        delete_element(value1);
-        stack_push(result_s, 0, 50, true, false);
     }
-    /* sin */
-    else if(comp_substr(source, token_start, token_end, "sin")){
-        stack_element * value1 = stack_pop();
-        pnumber result;
-        char result_s[50];
-        if(
-            !str_is_num((*value1).value, 0, strlen((*value1).value))
-        ){
-            error("trying to operate arithmetically with a non-numerical value.");
-        }
-        result = sin(atof((*value1).value));
-        num_to_str(result_s, result);
-        delete_element(value1);
-        stack_push(result_s, 0, 50, true, false);
+    (*code).effect_known = i == (*code).token_count;
+    (*code).needs = needs;
+    (*code).net = depth;
+    (*code).peak = peak;
+}
+
+bool token_effect(token * current, int * depth, int * needs, int * peak)
+{
+    /* Applies the effect of a token. Returns false if it can't be known. */
+    code_block ** blocks = (*current).blocks;
+    if((*current).kind == TOKEN_PUSH){
+        apply_effect(depth, needs, peak, 0, 1, 1);
     }
-    /* cos */
-    else if(comp_substr(source, token_start, token_end, "cos")){
-        stack_element * value1 = stack_pop();
-        pnumber result;
-        char result_s[50];
-        if(
-            !str_is_num((*value1).value, 0, strlen((*value1).value))
-        ){
-            error("trying to operate arithmetically with a non-numerical value.");
-        }
-        result = cos(atof((*value1).value));
-        num_to_str(result_s, result);
-        delete_element(value1);
-        stack_push(result_s, 0, 50, true, false);
+    else if((*current).kind == TOKEN_FUSED){
+        if((*current).target != null) apply_effect(depth, needs, peak, 0, 0, 0);
+        else apply_effect(depth, needs, peak, 0, 1, 1);
     }
-    /* tan */
-    else if(comp_substr(source, token_start, token_end, "tan")){
-        stack_element * value1 = stack_pop();
-        pnumber result;
-        char result_s[50];
-        if(
-            !str_is_num((*value1).value, 0, strlen((*value1).value))
-        ){
-            error("trying to operate arithmetically with a non-numerical value.");
+    else if((*current).kind == TOKEN_WORD){
+        int pops;
+        int pushes;
+        if((*current).word == WORD_SET_VAR){
+            pops = 1;
+            pushes = 0;
+        }else if((*current).word == WORD_GET_VAR){
+            pops = 0;
+            pushes = 1;
+        }else if((*current).word < RESERVED_WORDS && word_effects[(*current).word][0] >= 0){
+            pops = word_effects[(*current).word][0];
+            pushes = word_effects[(*current).word][1];
+        }else{
+            return false;
         }
-        result = tan(atof((*value1).value));
-        num_to_str(result_s, result);
-        delete_element(value1);
-        stack_push(result_s, 0, 50, true, false);
+        apply_effect(depth, needs, peak, pops, pushes - pops, pushes > pops ? pushes - pops : 0);
     }
-    /* log */
-    else if(comp_substr(source, token_start, token_end, "log")){
-        stack_element * value1 = stack_pop();
-        pnumber result;
-        char result_s[50];
-        if(
-            !str_is_num((*value1).value, 0, strlen((*value1).value))
-        ){
-            error("trying to operate arithmetically with a non-numerical value.");
-        }
-        result = log(atof((*value1).value));
-        num_to_str(result_s, result);
-        delete_element(value1);
-        stack_push(result_s, 0, 50, true, false);
+    else{
+        /* if and while with literal blocks. Only the condition is sure to
+           run: either branch of an if may be skipped, and so may the body of
+           a loop, so what they need can't be asked for up front. */
+        apply_effect(depth, needs, peak, (*blocks[0]).needs, 0, (*blocks[0]).peak);
+        return false;
     }
-    /* = */
-    else if(comp_substr(source, token_start, token_end, "=")){
-        stack_element * value2 = stack_pop();
-        stack_element * value1 = stack_pop();
-        if(
-            str_is_num((*value1).value, 0, strlen((*value1).value))
-            && str_is_num((*value2).value, 0, strlen((*value2).value))
-        ){
-            pnumber val1 = atof((*value1).value);
-            pnumber val2 = atof((*value2).value);
-            stack_push(fabs(val1 - val2) < EPSILON ? "1" : "0", 0, 50, true, false);
-        }else{
-            if(strcmp((*value1).value, (*value2).value) == 0){
-                stack_push("1", 0, 50, true, false);
-            }else{
-                stack_push("0", 0, 50, true, false);
-            }
+    return true;
+}
+
+void apply_effect(int * depth, int * needs, int * peak, int block_needs, int block_net, int block_peak)
+{
+    /* Adds the effect of a token or block to the effect of what came before it */
+    if(*depth - block_needs < -*needs){
+        *needs = block_needs - *depth;
+    }
+    if(*depth + block_peak > *peak){
+        *peak = *depth + block_peak;
+    }
+    *depth += block_net;
+}
+
+void check_stack(code_block * code)
+{
+    /* Called before the first token of a block runs. A block that will
+       certainly pop from an empty stack fails before doing anything, and
+       room is made for the values it will push. */
+    if((*code).needs > 0){
+        stack_element * element = stack;
+        int available = 0;
+        while(element != null && available < (*code).needs){
+            available++;
+            element = (*element).next;
+        }
+        if(available < (*code).needs){
+            fprintf(program_output, "A block needs %d values from the stack and there are only %d.\r\n", (*code).needs, available);
+            error("cannot pop from an empty stack.");
         }
-        delete_element(value2);
-        delete_element(value1);
     }
-    /* != */
-    else if(comp_substr(source, token_start, token_end, "!=")){
-        stack_element * value2 = stack_pop();
-        stack_element * value1 = stack_pop();
-        if(
-            str_is_num((*value1).value, 0, strlen((*value1).value))
-            && str_is_num((*value2).value, 0, strlen((*value2).value))
-        ){
-            pnumber val1 = atof((*value1).value);
-            pnumber val2 = atof((*value2).value);
-            stack_push(fabs(val1 - val2) > EPSILON ? "1" : "0", 0, 50, true, false);
-        }else{
-            if(strcmp((*value1).value, (*value2).value) != 0){
-                stack_push("1", 0, 50, true, false);
+    reserve_stack((size_t)(*code).peak);
+}
+
+void reserve_stack(size_t count)
+{
+    /* Makes sure count values can be pushed without allocating their
+       elements one at a time. Elements are never given back, deleted ones
+       are kept for the next push. */
+    stack_element * reserved;
+    size_t i;
+    if(free_element_count >= count){
+        return;
+    }
+    count -= free_element_count;
+    reserved = polaris_malloc(sizeof(stack_element) * count, MEMORY_STACK);
+    for(i = 0; i < count; ++i){
+        reserved[i].next = free_elements;
+        free_elements = &reserved[i];
+    }
+    free_element_count += count;
+}
+
+void remove_tokens(code_block * code, size_t from, size_t count)
+{
+    size_t i;
+    for(i = from; i < from + count; ++i){
+        free_token(&(*code).tokens[i]);
+    }
+    memmove(&(*code).tokens[from], &(*code).tokens[from + count],
+        sizeof(token) * ((*code).token_count - from - count));
+    (*code).token_count -= count;
+}
+
+void free_token(token * target)
+{
+    size_t i;
+    if((*target).text != null) polaris_free((*target).text);
+    if((*target).target != null) polaris_free((*target).target);
+    for(i = 0; i < (*target).operation_count; ++i){
+        polaris_free((*target).operands[i]);
+    }
+    if((*target).operations != null) polaris_free((*target).operations);
+    if((*target).operands != null) polaris_free((*target).operands);
+    for(i = 0; i < 3; ++i){
+        if((*target).blocks[i] != null) release_block((*target).blocks[i]);
+    }
+}
+
+void release_block(code_block * code)
+{
+    /* Unused blocks stay in the cache until it fills up */
+    (*code).references--;
+}
+
+void sweep_compiled_blocks()
+{
+    /* Frees every cached block that is no longer in use */
+    size_t bucket;
+    for(bucket = 0; bucket < COMPILECACHE; ++bucket){
+        code_block * previous = null;
+        code_block * code = compiled_blocks[bucket];
+        while(code != null){
+            code_block * following = (*code).next;
+            if((*code).references == 0){
+                size_t i;
+                for(i = 0; i < (*code).token_count; ++i){
+                    free_token(&(*code).tokens[i]);
+                }
+                if((*code).tokens != null) polaris_free((*code).tokens);
+                polaris_free((*code).source);
+                if((*code).name != null) polaris_free((*code).name);
+                polaris_free(code);
+                compiled_block_count--;
+                if(previous == null) compiled_blocks[bucket] = following;
+                else (*previous).next = following;
             }else{
-                stack_push("0", 0, 50, true, false);
+                previous = code;
             }
+            code = following;
         }
-        delete_element(value2);
-        delete_element(value1);
     }
-    /* ! */
-    else if(comp_substr(source, token_start, token_end, "!")){
-        stack_element * value1 = stack_pop();
-        if(strcmp((*value1).value, "0") == 0){
-            stack_push("1", 0, 50, true, false);
-        }else{
-            stack_push("0", 0, 50, true, false);
+}
+
+void release_abandoned_blocks()
+{
+    /* Called once the variables of a failed job are cleared. Nothing is
+       left then that holds on to a compiled block, so every reference still
+       counted belongs to a frame the job abandoned or to an evaluation it
+       cut short. Dropping them lets those blocks be swept. */
+    size_t bucket;
+    code_block * code;
+    for(bucket = 0; bucket < COMPILECACHE; ++bucket){
+        for(code = compiled_blocks[bucket]; code != null; code = (*code).next){
+            (*code).references = 0;
         }
-        delete_element(value1);
     }
-    /* < */
-    else if(comp_substr(source, token_start, token_end, "<")){
-        stack_element * value2 = stack_pop();
-        stack_element * value1 = stack_pop();
-        if(
-            str_is_num((*value1).value, 0, strlen((*value1).value))
-            && str_is_num((*value2).value, 0, strlen((*value2).value))
-        ){
-            pnumber val1 = atof((*value1).value);
-            pnumber val2 = atof((*value2).value);
-            stack_push(val1 < val2 ? "1" : "0", 0, 50, true, false);
-        }else{
-            if(strcmp((*value1).value, (*value2).value) < 0){
-                stack_push("1", 0, 50, true, false);
+    sweep_compiled_blocks();
+}
+
+unsigned long hash_string(char* source)
+{
+    unsigned long hash = 5381;
+    while(*source != '\0'){
+        hash = hash * 33 + (unsigned char)*source;
+        source++;
+    }
+    return hash;
+}
+
+void push_frame(int kind, code_block * code, code_block * alternate, char* base_path, bool owns_base_path)
+{
+    frame * new_frame = polaris_malloc(sizeof(frame), MEMORY_OTHER);
+    (*new_frame).kind = kind;
+    (*new_frame).code = code;
+    (*new_frame).alternate = alternate;
+    (*new_frame).base_path = base_path;
+    (*new_frame).owns_base_path = owns_base_path;
+    (*new_frame).checking = false;
+    (*new_frame).position = 0;
+    (*new_frame).saved_stack = null;
+    (*new_frame).key = null;
+    (*new_frame).scope = 0;
+    (*new_frame).next = frames;
+    (*code).references++;
+    if(alternate != null) (*alternate).references++;
+    frames = new_frame;
+}
+
+void pop_frame()
+{
+    frame * popped = frames;
+    frames = (*popped).next;
+    release_block((*popped).code);
+    if((*popped).alternate != null) release_block((*popped).alternate);
+    if((*popped).owns_base_path) polaris_free((*popped).base_path);
+    if((*popped).key != null) polaris_free((*popped).key);
+    if((*popped).kind == FRAME_SCOPE) delete_scope_variables((*popped).scope);
+    while((*popped).saved_stack != null){
+        stack_element * discarded = (*popped).saved_stack;
+        (*popped).saved_stack = (*discarded).next;
+        delete_element(discarded);
+    }
+    polaris_free(popped);
+}
+
+int run_frames(frame * stop_at, unsigned int slice)
+{
+    /* Runs the current task until its frames are back to stop_at. A slice of
+       0 runs without interruption, otherwise the task yields after that many
+       steps. */
+    unsigned int steps = 0;
+    while(frames != stop_at){
+        frame * current = frames;
+        if(slice != 0 && steps >= slice){
+            return RUN_YIELDED;
+        }
+        if((*current).kind == FRAME_IF){
+            /* The condition has been evaluated, the frame becomes the chosen block */
+            stack_element * result = stack_pop();
+            if(strcmp((*result).value, "0") != 0){
+                release_block((*current).alternate);
             }else{
-                stack_push("0", 0, 50, true, false);
+                release_block((*current).code);
+                (*current).code = (*current).alternate;
             }
+            (*current).alternate = null;
+            (*current).kind = FRAME_EVAL;
+            delete_element(result);
         }
-        delete_element(value2);
-        delete_element(value1);
-    }
-    /* > */
-    else if(comp_substr(source, token_start, token_end, ">")){
-        stack_element * value2 = stack_pop();
-        stack_element * value1 = stack_pop();
-        if(
-            str_is_num((*value1).value, 0, strlen((*value1).value))
-            && str_is_num((*value2).value, 0, strlen((*value2).value))
-        ){
-            pnumber val1 = atof((*value1).value);
-            pnumber val2 = atof((*value2).value);
-            stack_push(val1 > val2 ? "1" : "0", 0, 50, true, false);
-        }else{
-            if(strcmp((*value1).value, (*value2).value) > 0){
-                stack_push("1", 0, 50, true, false);
+        else if((*current).kind == FRAME_WHILE){
+            bool result;
+            if(!(*current).checking && test_block((*current).code, &result)){
+                /* Simple conditions are tested without a frame of their own */
+                if(result){
+                    push_frame(FRAME_EVAL, (*current).alternate, null, (*current).base_path, false);
+                }else{
+                    pop_frame();
+                }
+            }
+            else if(!(*current).checking){
+                (*current).checking = true;
+                push_frame(FRAME_EVAL, (*current).code, null, (*current).base_path, false);
             }else{
-                stack_push("0", 0, 50, true, false);
+                stack_element * result = stack_pop();
+                (*current).checking = false;
+                if(strcmp((*result).value, "0") != 0){
+                    delete_element(result);
+                    push_frame(FRAME_EVAL, (*current).alternate, null, (*current).base_path, false);
+                }else{
+                    delete_element(result);
+                    pop_frame();
+                }
             }
         }
-        delete_element(value2);
-        delete_element(value1);
-    }
-    /* <= */
-    else if(comp_substr(source, token_start, token_end, "<=")){
-        stack_element * value2 = stack_pop();
-        stack_element * value1 = stack_pop();
-        if(
-            str_is_num((*value1).value, 0, strlen((*value1).value))
-            && str_is_num((*value2).value, 0, strlen((*value2).value))
-        ){
-            pnumber val1 = atof((*value1).value);
-            pnumber val2 = atof((*value2).value);
-            stack_push(val1 <= val2 ? "1" : "0", 0, 50, true, false);
-        }else{
-            if(strcmp((*value1).value, (*value2).value) <= 0){
-                stack_push("1", 0, 50, true, false);
+        else if((*current).kind == FRAME_MEMO){
+            if(!(*current).checking){
+                (*current).checking = true;
+                push_frame(FRAME_EVAL, (*current).code, null, (*current).base_path, false);
             }else{
-                stack_push("0", 0, 50, true, false);
+                finish_memoized(current);
+                pop_frame();
             }
         }
-        delete_element(value2);
-        delete_element(value1);
-    }
-    /* >= */
-    else if(comp_substr(source, token_start, token_end, ">=")){
-        stack_element * value2 = stack_pop();
-        stack_element * value1 = stack_pop();
-        if(
-            str_is_num((*value1).value, 0, strlen((*value1).value))
-            && str_is_num((*value2).value, 0, strlen((*value2).value))
-        ){
-            pnumber val1 = atof((*value1).value);
-            pnumber val2 = atof((*value2).value);
-            stack_push(val1 >= val2 ? "1" : "0", 0, 50, true, false);
-        }else{
-            if(strcmp((*value1).value, (*value2).value) >= 0){
-                stack_push("1", 0, 50, true, false);
+        else if((*current).kind == FRAME_SCOPE){
+            if(!(*current).checking){
+                (*current).checking = true;
+                push_frame(FRAME_EVAL, (*current).code, null, (*current).base_path, false);
             }else{
-                stack_push("0", 0, 50, true, false);
+                pop_frame();
             }
         }
-        delete_element(value2);
-        delete_element(value1);
+        else if(step_frame(current) == RUN_WAITING){
+            return RUN_WAITING;
+        }
+        ++steps;
+        ++executed_steps;
+        #if OS_TYPE != 1
+            if(profiling && executed_steps % PROFILESTEPS == 0){
+                profile_pending = 1;
+            }
+        #endif
+        if(profile_pending){
+            take_sample();
+        }
+        if((*current_task).sleeping){
+            return RUN_WAITING;
+        }
+        if(current_generator != null && (*current_generator).yielded != null){
+            return RUN_WAITING;
+        }
     }
-    /* & */
-    else if(comp_substr(source, token_start, token_end, "&")){
-        stack_element * value2 = stack_pop();
-        stack_element * value1 = stack_pop();
-        if(strcmp((*value1).value, "0") != 0 && strcmp((*value2).value, "0") != 0){
-            stack_push("1", 0, 50, true, false);
-        }else{
-            stack_push("0", 0, 50, true, false);
+    return RUN_DONE;
+}
+
+int step_frame(frame * current)
+{
+    /* Evaluates the next token of an eval frame */
+    code_block * code = (*current).code;
+    token * next_token;
+    int result;
+    bool truth;
+    if((*current).position >= (*code).token_count){
+        pop_frame();
+        return RUN_DONE;
+    }
+    if((*current).position == 0){
+        check_stack(code);
+    }
+    /* Move on before the token can push new frames */
+    next_token = &(*code).tokens[(*current).position];
+    (*current).position++;
+    if((*next_token).kind == TOKEN_PUSH){
+        stack_push((*next_token).text, 0, strlen((*next_token).text), false, true);
+    }
+    else if((*next_token).kind == TOKEN_WORD){
+        result = eval_reserved_word((*next_token).word, next_token, (*current).base_path);
+        if(result == 2){
+            /* The token will be evaluated again when the task resumes */
+            (*current).position--;
+            return RUN_WAITING;
+        }
+        if(result != 0){
+            pop_frame();
         }
-        delete_element(value2);
-        delete_element(value1);
     }
-    /* | */
-    else if(comp_substr(source, token_start, token_end, "|")){
-        stack_element * value2 = stack_pop();
-        stack_element * value1 = stack_pop();
-        if(strcmp((*value1).value, "0") != 0 || strcmp((*value2).value, "0") != 0){
-            stack_push("1", 0, 50, true, false);
+    else if((*next_token).kind == TOKEN_FUSED){
+        apply_fused(next_token);
+    }
+    else if((*next_token).kind == TOKEN_IF){
+        if(test_block((*next_token).blocks[0], &truth)){
+            push_frame(FRAME_EVAL, (*next_token).blocks[truth ? 1 : 2], null, (*current).base_path, false);
         }else{
-            stack_push("0", 0, 50, true, false);
+            push_frame(FRAME_IF, (*next_token).blocks[1], (*next_token).blocks[2], (*current).base_path, false);
+            push_frame(FRAME_EVAL, (*next_token).blocks[0], null, (*current).base_path, false);
         }
-        delete_element(value2);
-        delete_element(value1);
     }
-    /* eval */
-    else if(comp_substr(source, token_start, token_end, "eval")){
-        stack_element * value = stack_pop();
-        eval((*value).value, base_path);
-        delete_element(value);
+    else if((*next_token).kind == TOKEN_WHILE){
+        push_frame(FRAME_WHILE, (*next_token).blocks[0], (*next_token).blocks[1], (*current).base_path, false);
     }
-    /* set */
-    else if(comp_substr(source, token_start, token_end, "set")){
-        stack_element * var = stack_pop();
-        stack_element * value = stack_pop();
-        set_var_value((*var).value, (*value).value);
-        delete_element(var);
-        delete_element(value);
+    return RUN_DONE;
+}
+
+void run_fused(token * fused, char* result_s)
+{
+    /* Computes the value of a fused token, the same as pushing the variable,
+       pushing each operand and applying each operation but without going
+       through the stack */
+    var_element * var = lookup_var((*fused).text, &(*fused).variable);
+    char * value;
+    size_t from = 0;
+    size_t to;
+    size_t i;
+    if(var == null){
+        fprintf(program_output, "When trying to get variable: %s\r\n", (*fused).text);
+        error("variable not found.");
     }
-    /* get */
-    else if(comp_substr(source, token_start, token_end, "get")){
-        stack_element * var = stack_pop();
-        get_var_value((*var).value);
-        delete_element(var);
+    /* Variables are trimmed when they are pushed */
+    value = (*var).value;
+    to = strlen(value);
+    while(from < to && (value[from] == ' ' || value[from] == '\t')) from++;
+    while(to > from && (value[to-1] == ' ' || value[to-1] == '\t')) to--;
+    if(from != 0 || value[to] != '\0'){
+        value = polaris_malloc(sizeof(char) * (to - from + 1), MEMORY_STRINGS);
+        copy_substr(value, (*var).value, from, to);
     }
-    /* if */
-    else if(comp_substr(source, token_start, token_end, "if")){
-        stack_element * else_block = stack_pop();
-        stack_element * if_block = stack_pop();
-        stack_element * condition_block = stack_pop();
-        stack_element * result;
-        eval((*condition_block).value, base_path);
-        result = stack_pop();
-        if(strcmp((*result).value, "0") != 0){
-            eval((*if_block).value, base_path);
-        }else{
-            eval((*else_block).value, base_path);
-        }
-        delete_element(else_block);
-        delete_element(if_block);
-        delete_element(condition_block);
-        delete_element(result);
+    operate((*fused).operations[0], value, (*fused).operands[0], result_s);
+    if(value != (*var).value) polaris_free(value);
+    for(i = 1; i < (*fused).operation_count; ++i){
+        operate((*fused).operations[i], result_s, (*fused).operands[i], result_s);
     }
-    /* while */
-    else if(comp_substr(source, token_start, token_end, "while")){
-        stack_element * while_block = stack_pop();
-        stack_element * condition_block = stack_pop();
-        while(true){
-            stack_element * result;
-            eval((*condition_block).value, base_path);
-            result = stack_pop();
-            if(strcmp((*result).value, "0") != 0){
-                delete_element(result);
-                eval((*while_block).value, base_path);
-            }else{
-                delete_element(result);
-                break;
-            }
-        }
-        delete_element(while_block);
-        delete_element(condition_block);
+}
+
+void apply_fused(token * fused)
+{
+    /* Runs a fused token, setting its target or pushing the result */
+    char result_s[NUMBERLENGTH];
+    run_fused(fused, result_s);
+    if((*fused).target != null){
+        var_element * target = lookup_var((*fused).target, &(*fused).target_variable);
+        if(target != null) assign_var(target, result_s);
+        else set_var_value((*fused).target, result_s);
+    }else{
+        stack_push(result_s, 0, strlen(result_s), false, true);
+    }
+}
+
+bool test_block(code_block * condition, bool * result)
+{
+    /* Evaluates a condition that is a single fused operation, like
+       (@n 0 >), directly. Returns false for any other condition. */
+    token * fused;
+    char result_s[NUMBERLENGTH];
+    if((*condition).token_count != 1){
+        return false;
+    }
+    fused = (*condition).tokens;
+    if((*fused).kind != TOKEN_FUSED || (*fused).target != null){
+        return false;
+    }
+    run_fused(fused, result_s);
+    *result = strcmp(result_s, "0") != 0;
+    return true;
+}
+
+void run_tasks()
+{
+    /* Runs the current frames as the main task, taking turns with every
+       task it spawns, every timer it sets and every connection it opens,
+       until there is nothing left to run. */
+    main_task = polaris_malloc(sizeof(task), MEMORY_OTHER);
+    main_stack = null;
+    main_running = true;
+    (*main_task).frames = frames;
+    (*main_task).stack = stack;
+    (*main_task).sleeping = false;
+    (*main_task).native = false;
+    (*main_task).next = tasks;
+    tasks = main_task;
+    while(tasks != null || timers != null || listener_count > 0){
+        if(!run_round()){
+            wait_for_progress();
+        }
+    }
+    current_task = null;
+    frames = null;
+    stack = main_stack;
+}
+
+bool run_round()
+{
+    /* Fires due timers and gives every task and connection a turn. Returns
+       whether anything happened. */
+    unsigned long now = polaris_ticks();
+    bool progressed = fire_timers(now);
+    task * previous = null;
+    task * current = tasks;
+    if((connection_count > 0 || input_waiting) && poll_connections(0)){
+        progressed = true;
+    }
+    while(current != null){
+        unsigned long steps_before = executed_steps;
+        task * following;
+        if((*current).native){
+            /* Translated code takes its turns by itself */
+            previous = current;
+            current = (*current).next;
+            continue;
+        }
+        if((*current).sleeping){
+            if((long)(now - (*current).wake_at) < 0){
+                previous = current;
+                current = (*current).next;
+                continue;
+            }
+            (*current).sleeping = false;
+        }
+        current_task = current;
+        frames = (*current).frames;
+        stack = (*current).stack;
+        run_frames(null, TASKSLICE);
+        (*current).frames = frames;
+        (*current).stack = stack;
+        if(executed_steps != steps_before){
+            progressed = true;
+        }
+        following = (*current).next;
+        if(frames == null){
+            /* The task has finished */
+            if(current == main_task){
+                main_stack = stack;
+                main_running = false;
+                main_task = null;
+            }else{
+                while(stack != null){
+                    delete_element(stack_pop());
+                }
+            }
+            if(previous == null) tasks = following;
+            else (*previous).next = following;
+            polaris_free(current);
+        }else{
+            previous = current;
+        }
+        current = following;
+    }
+    return progressed;
+}
+
+void wait_for_progress()
+{
+    /* Called when nothing could run. Sleeps until the next task or timer is
+       due or a connection has something to do. Tasks still waiting on a
+       channel once the main task has finished and nothing else can run are
+       discarded. */
+    unsigned long wake_at;
+    if(next_wakeup(&wake_at)){
+        long remaining = (long)(wake_at - polaris_ticks());
+        if(remaining > 1000) remaining = 1000;
+        if(connection_count > 0 || input_waiting) poll_connections(remaining > 0 ? remaining : 0);
+        else polaris_delay(remaining);
+    }
+    else if(connection_count > 0 || input_waiting){
+        poll_connections(1000);
+    }
+    else{
+        if(main_running){
+            error("every task is waiting on a channel (deadlock).");
+        }
+        while(tasks != null){
+            task * waiting = tasks;
+            tasks = (*waiting).next;
+            frames = (*waiting).frames;
+            stack = (*waiting).stack;
+            while(frames != null){
+                pop_frame();
+            }
+            while(stack != null){
+                delete_element(stack_pop());
+            }
+            polaris_free(waiting);
+        }
+    }
+}
+
+task * spawn_task(char* source, char* base_path)
+{
+    /* Adds a task that evaluates source on its own stack */
+    task * new_task = polaris_malloc(sizeof(task), MEMORY_OTHER);
+    task * last = tasks;
+    frame * spawning_frames = frames;
+    frames = null;
+    push_frame(FRAME_EVAL, compile_block(source), null, copy_string(base_path), true);
+    (*new_task).frames = frames;
+    (*new_task).stack = null;
+    (*new_task).sleeping = false;
+    (*new_task).native = false;
+    (*new_task).next = null;
+    frames = spawning_frames;
+    if(last == null){
+        tasks = new_task;
+        return new_task;
+    }
+    while((*last).next != null){
+        last = (*last).next;
+    }
+    (*last).next = new_task;
+    return new_task;
+}
+
+unsigned long add_timer(char* source, char* base_path, unsigned long delay, bool repeat)
+{
+    /* Schedules source to be spawned as a task after delay milliseconds,
+       and every delay milliseconds after that if repeat is set */
+    timer * new_timer = polaris_malloc(sizeof(timer), MEMORY_OTHER);
+    (*new_timer).source = source;
+    (*new_timer).base_path = copy_string(base_path);
+    (*new_timer).id = ++timer_count;
+    (*new_timer).due = polaris_ticks() + delay;
+    (*new_timer).interval = repeat ? (delay > 0 ? delay : 1) : 0;
+    (*new_timer).next = timers;
+    timers = new_timer;
+    return (*new_timer).id;
+}
+
+void cancel_timer(unsigned long id)
+{
+    timer * previous = null;
+    timer * current = timers;
+    while(current != null){
+        if((*current).id == id){
+            if(previous == null) timers = (*current).next;
+            else (*previous).next = (*current).next;
+            polaris_free((*current).source);
+            polaris_free((*current).base_path);
+            polaris_free(current);
+            return;
+        }
+        previous = current;
+        current = (*current).next;
+    }
+}
+
+bool fire_timers(unsigned long now)
+{
+    /* Spawns a task for every timer that is due. Returns true if any fired. */
+    bool fired = false;
+    timer * current = timers;
+    while(current != null){
+        timer * following = (*current).next;
+        if((long)(now - (*current).due) >= 0){
+            fired = true;
+            spawn_task((*current).source, (*current).base_path);
+            if((*current).interval != 0){
+                (*current).due += (*current).interval;
+                if((long)(now - (*current).due) >= 0){
+                    /* Don't try to catch up on missed ticks */
+                    (*current).due = now + (*current).interval;
+                }
+            }else{
+                cancel_timer((*current).id);
+            }
+        }
+        current = following;
+    }
+    return fired;
+}
+
+bool next_wakeup(unsigned long * wake_at)
+{
+    /* Finds the earliest time a sleeping task or a timer is due */
+    bool found = false;
+    task * waiting_task = tasks;
+    timer * current_timer = timers;
+    while(waiting_task != null){
+        if((*waiting_task).sleeping && (!found || (long)((*waiting_task).wake_at - *wake_at) < 0)){
+            *wake_at = (*waiting_task).wake_at;
+            found = true;
+        }
+        waiting_task = (*waiting_task).next;
+    }
+    while(current_timer != null){
+        if(!found || (long)((*current_timer).due - *wake_at) < 0){
+            *wake_at = (*current_timer).due;
+            found = true;
+        }
+        current_timer = (*current_timer).next;
+    }
+    return found;
+}
+
+channel * get_channel(char* name)
+{
+    /* Finds a channel by name, creating it if it doesn't exist */
+    channel * current = channels;
+    while(current != null){
+        if(strcmp((*current).name, name) == 0){
+            return current;
+        }
+        current = (*current).next;
+    }
+    current = polaris_malloc(sizeof(channel), MEMORY_OTHER);
+    (*current).name = copy_string(name);
+    (*current).first = null;
+    (*current).last = null;
+    (*current).count = 0;
+    (*current).next = channels;
+    channels = current;
+    return current;
+}
+
+unsigned long new_generator(char* source, char* base_path)
+{
+    /* Creates a generator that will evaluate source on its own stack, a
+       piece at a time, whenever a value is requested from it */
+    generator * new_gen = polaris_malloc(sizeof(generator), MEMORY_OTHER);
+    frame * creating_frames = frames;
+    frames = null;
+    push_frame(FRAME_EVAL, compile_block(source), null, copy_string(base_path), true);
+    (*new_gen).frames = frames;
+    frames = creating_frames;
+    (*new_gen).stack = null;
+    (*new_gen).yielded = null;
+    (*new_gen).finished = false;
+    (*new_gen).id = ++generator_count;
+    (*new_gen).next = generators;
+    generators = new_gen;
+    return (*new_gen).id;
+}
+
+generator * get_generator(char* handle)
+{
+    generator * current = generators;
+    unsigned long id = (unsigned long)atof(handle);
+    while(current != null){
+        if((*current).id == id){
+            return current;
+        }
+        current = (*current).next;
+    }
+    fprintf(program_output, "When trying to use generator: %s\r\n", handle);
+    error("generator not found.");
+    return null;
+}
+
+bool resume_generator(generator * target)
+{
+    /* Runs a generator until it yields a value or finishes. Returns true if
+       a value was yielded, leaving it in the generator. */
+    generator * consumer = current_generator;
+    frame * consumer_frames = frames;
+    stack_element * consumer_stack = stack;
+    if((*target).finished){
+        return false;
+    }
+    current_generator = target;
+    frames = (*target).frames;
+    stack = (*target).stack;
+    nested_evaluations++;
+    if(run_frames(null, 0) == RUN_WAITING && (*target).yielded == null){
+        error("cannot wait on a channel from inside a generator.");
+    }
+    nested_evaluations--;
+    (*target).frames = frames;
+    (*target).stack = stack;
+    if(frames == null){
+        /* The generator has run to completion */
+        while(stack != null){
+            delete_element(stack_pop());
+        }
+        (*target).stack = null;
+        (*target).finished = true;
+    }
+    current_generator = consumer;
+    frames = consumer_frames;
+    stack = consumer_stack;
+    return (*target).yielded != null;
+}
+
+connection * get_connection(char* handle)
+{
+    int descriptor = atoi(handle);
+    if(descriptor < 0 || descriptor >= connection_table_size || connection_table[descriptor] == null){
+        fprintf(program_output, "When trying to use connection: %s\r\n", handle);
+        error("connection not found.");
+    }
+    return connection_table[descriptor];
+}
+
+connection * add_connection(int descriptor)
+{
+    /* Registers a socket with the reactor, making it non-blocking */
+    connection * added = new_connection(descriptor);
+    #if OS_TYPE == 1
+        fcntl(descriptor, F_SETFL, fcntl(descriptor, F_GETFL) | O_NONBLOCK);
+    #endif
+    if(descriptor >= connection_table_size){
+        int i;
+        int new_size = connection_table_size == 0 ? 64 : connection_table_size;
+        while(new_size <= descriptor) new_size *= 2;
+        connection_table = polaris_realloc(connection_table, sizeof(connection *) * new_size, MEMORY_OTHER);
+        for(i = connection_table_size; i < new_size; ++i) connection_table[i] = null;
+        connection_table_size = new_size;
+    }
+    connection_table[descriptor] = added;
+    connection_count++;
+    return added;
+}
+
+connection * new_connection(int descriptor)
+{
+    /* Creates the buffers of a descriptor without registering it */
+    connection * created = polaris_malloc(sizeof(connection), MEMORY_OTHER);
+    (*created).descriptor = descriptor;
+    (*created).listening = false;
+    (*created).connecting = false;
+    (*created).closing = false;
+    (*created).closed = false;
+    (*created).inbound = polaris_malloc(sizeof(char) * SOCKETBUFFER, MEMORY_OTHER);
+    (*created).inbound_start = 0;
+    (*created).inbound_length = 0;
+    (*created).outbound = null;
+    (*created).outbound_length = 0;
+    (*created).handler = null;
+    (*created).base_path = null;
+    return created;
+}
+
+void close_connection(connection * target)
+{
+    /* Closes a connection once its pending output has been sent */
+    if((*target).outbound_length > 0 && !(*target).closed){
+        (*target).closing = true;
+        return;
+    }
+    #if OS_TYPE == 1
+        close((*target).descriptor);
+    #endif
+    if((*target).listening){
+        polaris_free((*target).handler);
+        polaris_free((*target).base_path);
+        listener_count--;
+    }
+    connection_table[(*target).descriptor] = null;
+    connection_count--;
+    polaris_free((*target).inbound);
+    if((*target).outbound != null) polaris_free((*target).outbound);
+    polaris_free(target);
+}
+
+int open_listener(char* port, char* handler, char* base_path)
+{
+    /* Listens on a TCP port. Every accepted connection spawns a task that
+       evaluates handler with the connection handle on its stack. */
+    #if OS_TYPE == 1
+        struct addrinfo hints;
+        struct addrinfo * address;
+        connection * listener;
+        int descriptor;
+        int reuse = 1;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        signal(SIGPIPE, SIG_IGN);
+        if(getaddrinfo(null, port, &hints, &address) != 0){
+            error("invalid port for serve.");
+        }
+        descriptor = socket((*address).ai_family, (*address).ai_socktype, (*address).ai_protocol);
+        if(descriptor < 0){
+            freeaddrinfo(address);
+            error("couldn't listen on the requested port.");
+        }
+        setsockopt(descriptor, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if(
+            bind(descriptor, (*address).ai_addr, (*address).ai_addrlen) != 0
+            || listen(descriptor, SOMAXCONN) != 0
+        ){
+            close(descriptor);
+            freeaddrinfo(address);
+            error("couldn't listen on the requested port.");
+        }
+        freeaddrinfo(address);
+        listener = add_connection(descriptor);
+        (*listener).listening = true;
+        (*listener).handler = handler;
+        (*listener).base_path = copy_string(base_path);
+        listener_count++;
+        return descriptor;
+    #else
+        polaris_free(handler);
+        error("sockets are not supported on this system.");
+        return -1;
+    #endif
+}
+
+int open_connection(char* host, char* port)
+{
+    /* Starts connecting to a TCP server without waiting for it */
+    #if OS_TYPE == 1
+        struct addrinfo hints;
+        struct addrinfo * address;
+        connection * new_connection;
+        int descriptor;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        signal(SIGPIPE, SIG_IGN);
+        if(getaddrinfo(host, port, &hints, &address) != 0){
+            error("couldn't resolve the requested host.");
+        }
+        descriptor = socket((*address).ai_family, (*address).ai_socktype, (*address).ai_protocol);
+        if(descriptor < 0){
+            freeaddrinfo(address);
+            error("couldn't create a socket.");
+        }
+        new_connection = add_connection(descriptor);
+        if(connect(descriptor, (*address).ai_addr, (*address).ai_addrlen) != 0){
+            if(errno == EINPROGRESS){
+                (*new_connection).connecting = true;
+            }else{
+                (*new_connection).closed = true;
+            }
+        }
+        freeaddrinfo(address);
+        return descriptor;
+    #else
+        error("sockets are not supported on this system.");
+        return -1;
+    #endif
+}
+
+void queue_output(connection * target, char* value)
+{
+    /* Adds value, with its escape sequences resolved, to the pending output */
+    (*target).outbound = polaris_realloc((*target).outbound,
+        sizeof(char) * ((*target).outbound_length + strlen(value) + 1), MEMORY_OTHER);
+    (*target).outbound_length += unescape((*target).outbound + (*target).outbound_length, value);
+    if(!(*target).connecting){
+        flush_output(target);
+    }
+}
+
+void flush_output(connection * target)
+{
+    /* Sends as much pending output as the socket takes without blocking */
+    #if OS_TYPE == 1
+        while((*target).outbound_length > 0 && !(*target).closed){
+            ssize_t sent = send((*target).descriptor, (*target).outbound, (*target).outbound_length, 0);
+            if(sent < 0){
+                if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR){
+                    (*target).closed = true;
+                }
+                break;
+            }
+            memmove((*target).outbound, (*target).outbound + sent, (*target).outbound_length - sent);
+            (*target).outbound_length -= sent;
+        }
+        if((*target).closed){
+            (*target).outbound_length = 0;
+        }
+        if((*target).closing && (*target).outbound_length == 0){
+            close_connection(target);
+        }
+    #endif
+}
+
+bool poll_connections(int timeout)
+{
+    /* Waits up to timeout milliseconds for any connection to be ready and
+       services it: accepting clients, reading input and sending output.
+       Returns true if anything happened that a task could be waiting on. */
+    #if OS_TYPE == 1
+        struct pollfd * watched = polaris_malloc(sizeof(struct pollfd) * (connection_count + 1), MEMORY_OTHER);
+        nfds_t watched_count = 0;
+        bool serviced = false;
+        int input_slot = -1;
+        int i;
+        for(i = 0; i < connection_table_size; ++i){
+            connection * target = connection_table[i];
+            if(target == null || (*target).closed) continue;
+            watched[watched_count].fd = i;
+            watched[watched_count].events = 0;
+            watched[watched_count].revents = 0;
+            if((*target).listening
+                || (!(*target).connecting && (*target).inbound_length < MAXPENDINGINPUT)){
+                watched[watched_count].events |= POLLIN;
+            }
+            if((*target).connecting || (*target).outbound_length > 0){
+                watched[watched_count].events |= POLLOUT;
+            }
+            watched_count++;
+        }
+        if(input_waiting && !(*stdin_connection).closed && (*stdin_connection).inbound_length < MAXPENDINGINPUT){
+            /* stdin is only watched while a task waits for a line, so input
+               that nobody asked for is left to whoever reads it */
+            input_slot = (int)watched_count;
+            watched[watched_count].fd = (*stdin_connection).descriptor;
+            watched[watched_count].events = POLLIN;
+            watched[watched_count].revents = 0;
+            watched_count++;
+        }
+        if(poll(watched, watched_count, timeout) <= 0){
+            polaris_free(watched);
+            return false;
+        }
+        for(i = 0; i < (int)watched_count; ++i){
+            connection * target = i == input_slot ? stdin_connection : connection_table[watched[i].fd];
+            if(watched[i].revents == 0 || target == null) continue;
+            serviced = true;
+            if((*target).listening){
+                int client;
+                while((client = accept((*target).descriptor, null, null)) >= 0){
+                    char handle[50];
+                    task * handler_task = spawn_task((*target).handler, (*target).base_path);
+                    stack_element * saved_stack = stack;
+                    add_connection(client);
+                    sprintf(handle, "%d", client);
+                    stack = null;
+                    stack_push(handle, 0, strlen(handle), false, true);
+                    (*handler_task).stack = stack;
+                    stack = saved_stack;
+                }
+                continue;
+            }
+            if((*target).connecting){
+                int failure = 0;
+                socklen_t failure_size = sizeof(failure);
+                getsockopt((*target).descriptor, SOL_SOCKET, SO_ERROR, &failure, &failure_size);
+                (*target).connecting = false;
+                if(failure != 0){
+                    (*target).closed = true;
+                    continue;
+                }
+            }
+            if(watched[i].revents & (POLLIN | POLLHUP | POLLERR)){
+                receive_data(target);
+            }
+            if(i != input_slot && connection_table[watched[i].fd] == target && (*target).outbound_length > 0){
+                flush_output(target);
+            }
+        }
+        polaris_free(watched);
+        return serviced;
+    #else
+        if(timeout > 0) polaris_delay(timeout);
+        return false;
+    #endif
+}
+
+void receive_data(connection * target)
+{
+    /* Reads what a descriptor has ready once poll says so, which doesn't
+       block even on descriptors that aren't non-blocking, like stdin */
+    #if OS_TYPE == 1
+        ssize_t received;
+        /* Move unread input to the front and make room for more */
+        memmove((*target).inbound, (*target).inbound + (*target).inbound_start, (*target).inbound_length);
+        (*target).inbound_start = 0;
+        (*target).inbound = polaris_realloc((*target).inbound,
+            sizeof(char) * ((*target).inbound_length + SOCKETBUFFER), MEMORY_OTHER);
+        received = read((*target).descriptor, (*target).inbound + (*target).inbound_length, SOCKETBUFFER);
+        if(received > 0){
+            (*target).inbound_length += received;
+        }else if(received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)){
+            (*target).closed = true;
+        }
+    #endif
+}
+
+int take_input()
+{
+    /* Pushes a line of input. On Unix stdin is read by the reactor, so a
+       task waiting for a line lets the others run: returns 2 until the
+       line has arrived. Nested evaluations can't be left to wait, so they
+       poll until it has. Jobs have no input, stdin holds the next jobs. */
+    char * input;
+    #if OS_TYPE == 1
+        if(!serve_jobs){
+            char * line;
+            char * line_end;
+            size_t line_length;
+            if(stdin_connection == null){
+                stdin_connection = new_connection(STDIN_FILENO);
+            }
+            while(true){
+                line = (*stdin_connection).inbound + (*stdin_connection).inbound_start;
+                line_end = (*stdin_connection).inbound_length == 0 ? null
+                    : memchr(line, '\n', (*stdin_connection).inbound_length);
+                if(line_end != null || (*stdin_connection).closed
+                    || (*stdin_connection).inbound_length >= MAXINPUTLENGTH - 1){
+                    break;
+                }
+                input_waiting = true;
+                if(nested_evaluations == 0){
+                    return 2;
+                }
+                poll_connections(1000);
+            }
+            input_waiting = false;
+            /* Cut where fgets would cut it, keeping the newline */
+            line_length = line_end == null ? (*stdin_connection).inbound_length : (size_t)(line_end - line) + 1;
+            if(line_length > MAXINPUTLENGTH - 1) line_length = MAXINPUTLENGTH - 1;
+            stack_push(line, 0, line_length, false, true);
+            (*stdin_connection).inbound_start += line_length;
+            (*stdin_connection).inbound_length -= line_length;
+            return 0;
+        }
+    #endif
+    input = polaris_malloc(sizeof(char) * (MAXINPUTLENGTH + 1), MEMORY_STRINGS);
+    if(running_jobs || fgets(input, MAXINPUTLENGTH, stdin) == null){
+        input[0] = '\0';
+    }
+    stack_push(input, 0, strlen(input), false, true);
+    polaris_free(input);
+    return 0;
+}
+
+size_t unescape(char* destination, char* source)
+{
+    /* Copies source resolving its escape sequences. Returns the length. */
+    size_t length = 0;
+    size_t val_len = strlen(source);
+    size_t i;
+    for(i = 0; i < val_len; ++i){
+        if(source[i] == '\\' && i < val_len){
+            char escaped = source[i+1];
+            ++i;
+            if(escaped == 'n') destination[length++] = '\n';
+            else if(escaped == 'r') destination[length++] = '\r';
+            else if(escaped == 't') destination[length++] = '\t';
+            else if(escaped == 'b') destination[length++] = '\b';
+            else if(escaped == 'a') destination[length++] = '\a';
+            else if(escaped == 'v') destination[length++] = '\v';
+            else if(escaped == 'f') destination[length++] = '\f';
+            else if(escaped == '\\') destination[length++] = '\\';
+            else if(escaped == '"') destination[length++] = '"';
+            else{
+                destination[length++] = '\\';
+                --i;
+            }
+        }else{
+            destination[length++] = source[i];
+        }
+    }
+    destination[length] = '\0';
+    return length;
+}
+
+void * polaris_malloc(size_t size, int category)
+{
+    /* Every allocation goes through here so -m can tell where the memory went */
+    return polaris_realloc(null, size, category);
+}
+
+void * polaris_realloc(void * block, size_t size, int category)
+{
+    memory_header * header = null;
+    if(block != null){
+        header = (memory_header *)block - 1;
+        category = (*header).block.category;
+        forget_memory(header);
+    }
+    header = realloc(header, sizeof(memory_header) + size);
+    if(header == null){
+        error("out of memory.");
+    }
+    account_memory(header, category, size);
+    return header + 1;
+}
+
+void polaris_free(void * block)
+{
+    memory_header * header;
+    if(block == null) return;
+    header = (memory_header *)block - 1;
+    forget_memory(header);
+    free(header);
+}
+
+void account_memory(memory_header * header, int category, size_t size)
+{
+    /* Records a block of size bytes. Blocks of 0 bytes still have their
+       header, so they are counted until they are freed like any other. */
+    (*header).block.size = size;
+    (*header).block.category = category;
+    #if OS_TYPE == 1
+        if(map_running){
+            /* Map workers count on their own, so they never wait on each other */
+            map_worker * worker = pthread_getspecific(map_worker_key);
+            (*worker).memory_in_use[category] += size;
+            (*worker).memory_blocks[category]++;
+            (*worker).memory_allocations[category]++;
+            if((*worker).memory_in_use[category] > (*worker).memory_peak[category]){
+                (*worker).memory_peak[category] = (*worker).memory_in_use[category];
+            }
+            return;
+        }
+    #endif
+    memory_in_use[category] += size;
+    memory_blocks[category]++;
+    memory_allocations[category]++;
+    if(memory_in_use[category] > memory_peak[category]){
+        memory_peak[category] = memory_in_use[category];
+    }
+}
+
+void forget_memory(memory_header * header)
+{
+    /* Stops counting a block that is about to be freed or moved */
+    int category = (*header).block.category;
+    #if OS_TYPE == 1
+        if(map_running){
+            map_worker * worker = pthread_getspecific(map_worker_key);
+            (*worker).memory_in_use[category] -= (*header).block.size;
+            (*worker).memory_blocks[category]--;
+            return;
+        }
+    #endif
+    memory_in_use[category] -= (*header).block.size;
+    memory_blocks[category]--;
+}
+
+size_t memory_size(void * block)
+{
+    if(block == null) return 0;
+    return ((memory_header *)block - 1)[0].block.size;
+}
+
+void report_memory()
+{
+    /* Shown by -m once the program has finished */
+    var_element * current;
+    int i;
+    fprintf(program_output, "%-10s %12s %12s %10s %12s\r\n", "Memory", "In use", "Peak", "Blocks", "Allocations");
+    for(i = 0; i < MEMORY_CATEGORIES; ++i){
+        fprintf(program_output, "%-10s %12lu %12lu %10lu %12lu\r\n", memory_categories[i],
+            memory_in_use[i], memory_peak[i], memory_blocks[i], memory_allocations[i]);
+    }
+    fprintf(program_output, "%lu stack elements kept for reuse.\r\n", (unsigned long)free_element_count);
+    fprintf(program_output, "Variables still reachable:\r\n");
+    for(current = variables; current != null; current = (*current).next){
+        size_t size = memory_size(current) + memory_size((*current).name) + memory_size((*current).value);
+        fprintf(program_output, "%10lu %s\r\n", (unsigned long)size, (*current).name);
+    }
+}
+
+char * copy_string(char* source)
+{
+    char * copy = polaris_malloc(sizeof(char) * (strlen(source) + 1), MEMORY_STRINGS);
+    strcpy(copy, source);
+    return copy;
+}
+
+bool str_is_num(char* source, size_t from, size_t to){
+    bool already_found_sign = false;
+    bool already_found_point = false;
+    size_t numbers_before_point = 0;
+    size_t numbers_after_point = 0;
+    size_t i;
+    for(i = from; i < to; ++i){
+        if(!already_found_sign && source[i] == '-'){
+            already_found_sign = true;
+        }
+        else if(!already_found_point && source[i] == '.'){
+            already_found_point = true;
+        }else if(
+            source[i] == '0' || source[i] == '1' 
+            || source[i] == '2' || source[i] == '3'
+            || source[i] == '4' || source[i] == '5'
+            || source[i] == '6' || source[i] == '7'
+            || source[i] == '8' || source[i] == '9'
+            )
+        {
+            already_found_sign = true;
+            if(already_found_point){
+                numbers_after_point++;
+            }else{
+                numbers_before_point++;
+            }
+        }else if((source[i] == 'e' || source[i] == 'E') && numbers_before_point > 0 && i + 1 < to){
+            /* Exponent, as very large numbers are written */
+            if(already_found_point && numbers_after_point == 0){
+                return false;
+            }
+            ++i;
+            if(source[i] == '-' || source[i] == '+') ++i;
+            if(i == to) return false;
+            for(; i < to; ++i){
+                if(source[i] < '0' || source[i] > '9') return false;
+            }
+            return true;
+        }else{
+            return false;
+        }
+    }
+    if(numbers_before_point == 0){
+        return false;
+    }
+    if(already_found_point && numbers_after_point == 0){
+        return false;
+    }
+    return true;
+}
+
+int eval_reserved_word(int word, token * current_token, char* base_path){
+    /* print */
+    if(word == WORD_PRINT){
+        stack_element * value = stack_pop();
+        char * text = polaris_malloc(sizeof(char) * (strlen((*value).value) + 1), MEMORY_STRINGS);
+        fwrite(text, 1, unescape(text, (*value).value), program_output);
+        #if OS_TYPE == 1
+            fflush(stdout);
+        #endif
+        polaris_free(text);
+        delete_element(value);
+    }
+    /* + - * / % // ** */
+    else if(is_arithmetic(word)){
+        stack_element * value2 = stack_pop();
+        stack_element * value1 = stack_pop();
+        char result_s[NUMBERLENGTH];
+        operate(word, (*value1).value, (*value2).value, result_s);
+        delete_element(value2);
+        delete_element(value1);
+        stack_push(result_s, 0, strlen(result_s), true, false);
+    }
+    /* sin cos tan log */
+    else if(word >= WORD_SIN && word <= WORD_LOG){
+        stack_element * value1 = stack_pop();
+        char result_s[NUMBERLENGTH];
+        operate_function(word, (*value1).value, result_s);
+        delete_element(value1);
+        stack_push_text(result_s);
+    }
+    /* = != < > <= >= */
+    else if(is_comparison(word)){
+        stack_element * value2 = stack_pop();
+        stack_element * value1 = stack_pop();
+        char result_s[NUMBERLENGTH];
+        operate(word, (*value1).value, (*value2).value, result_s);
+        stack_push(result_s, 0, strlen(result_s), true, false);
+        delete_element(value2);
+        delete_element(value1);
+    }
+    /* ! */
+    else if(word == WORD_NOT){
+        stack_element * value1 = stack_pop();
+        if(strcmp((*value1).value, "0") == 0){
+            stack_push_text("1");
+        }else{
+            stack_push_text("0");
+        }
+        delete_element(value1);
+    }
+    /* & */
+    else if(word == WORD_AND){
+        stack_element * value2 = stack_pop();
+        stack_element * value1 = stack_pop();
+        if(strcmp((*value1).value, "0") != 0 && strcmp((*value2).value, "0") != 0){
+            stack_push_text("1");
+        }else{
+            stack_push_text("0");
+        }
+        delete_element(value2);
+        delete_element(value1);
+    }
+    /* | */
+    else if(word == WORD_OR){
+        stack_element * value2 = stack_pop();
+        stack_element * value1 = stack_pop();
+        if(strcmp((*value1).value, "0") != 0 || strcmp((*value2).value, "0") != 0){
+            stack_push_text("1");
+        }else{
+            stack_push_text("0");
+        }
+        delete_element(value2);
+        delete_element(value1);
+    }
+    /* eval */
+    else if(word == WORD_EVAL){
+        stack_element * value = stack_pop();
+        push_frame(FRAME_EVAL, compile_block((*value).value), null, base_path, false);
+        delete_element(value);
+    }
+    /* set */
+    else if(word == WORD_SET){
+        stack_element * var = stack_pop();
+        stack_element * value = stack_pop();
+        set_var_value((*var).value, (*value).value);
+        delete_element(var);
+        delete_element(value);
+    }
+    /* unset */
+    else if(word == WORD_UNSET){
+        stack_element * var = stack_pop();
+        unset_var((*var).value);
+        delete_element(var);
+    }
+    /* unsetall */
+    else if(word == WORD_UNSETALL){
+        stack_element * prefix = stack_pop();
+        unset_prefix((*prefix).value);
+        delete_element(prefix);
+    }
+    /* scope */
+    else if(word == WORD_SCOPE){
+        stack_element * value = stack_pop();
+        push_frame(FRAME_SCOPE, compile_block((*value).value), null, base_path, false);
+        (*frames).scope = ++scope_count;
+        delete_element(value);
+    }
+    /* match, search */
+    else if(word == WORD_MATCH || word == WORD_SEARCH){
+        stack_element * pattern = stack_pop();
+        stack_element * text = stack_pop();
+        long found[2 * MAXCAPTURES];
+        if(run_regex(compile_regex((*pattern).value), (*text).value, strlen((*text).value), 0, word == WORD_MATCH, found)){
+            stack_push_text("1");
+        }else{
+            stack_push_text("0");
+        }
+        delete_element(pattern);
+        delete_element(text);
+    }
+    /* captures */
+    else if(word == WORD_CAPTURES){
+        stack_element * pattern = stack_pop();
+        stack_element * text = stack_pop();
+        regex * compiled = compile_regex((*pattern).value);
+        long found[2 * MAXCAPTURES];
+        if(run_regex(compiled, (*text).value, strlen((*text).value), 0, false, found)){
+            char result_s[50];
+            int group;
+            for(group = 0; group < (*compiled).groups; ++group){
+                if(found[2 * group] >= 0){
+                    stack_push((*text).value, found[2 * group], found[2 * group + 1], false, true);
+                }else{
+                    stack_push_text("");
+                }
+            }
+            sprintf(result_s, "%d", (*compiled).groups);
+            stack_push(result_s, 0, strlen(result_s), false, false);
+        }else{
+            stack_push_text("0");
+        }
+        delete_element(pattern);
+        delete_element(text);
+    }
+    /* format */
+    else if(word == WORD_FORMAT){
+        stack_element * template = stack_pop();
+        format_template((*template).value);
+        delete_element(template);
+    }
+    /* gsub */
+    else if(word == WORD_GSUB){
+        stack_element * replacement = stack_pop();
+        stack_element * pattern = stack_pop();
+        stack_element * text = stack_pop();
+        substitute_regex((*text).value, compile_regex((*pattern).value), (*replacement).value);
+        delete_element(replacement);
+        delete_element(pattern);
+        delete_element(text);
+    }
+    /* get */
+    else if(word == WORD_GET){
+        stack_element * var = stack_pop();
+        get_var_value((*var).value, null);
+        delete_element(var);
+    }
+    /* if */
+    else if(word == WORD_IF){
+        stack_element * else_block = stack_pop();
+        stack_element * if_block = stack_pop();
+        stack_element * condition_block = stack_pop();
+        code_block * if_code = compile_block((*if_block).value);
+        (*if_code).references++;
+        push_frame(FRAME_IF, if_code, compile_block((*else_block).value), base_path, false);
+        release_block(if_code);
+        push_frame(FRAME_EVAL, compile_block((*condition_block).value), null, base_path, false);
+        delete_element(else_block);
+        delete_element(if_block);
+        delete_element(condition_block);
+    }
+    /* while */
+    else if(word == WORD_WHILE){
+        stack_element * while_block = stack_pop();
+        stack_element * condition_block = stack_pop();
+        code_block * condition_code = compile_block((*condition_block).value);
+        (*condition_code).references++;
+        push_frame(FRAME_WHILE, condition_code, compile_block((*while_block).value), base_path, false);
+        release_block(condition_code);
+        delete_element(while_block);
+        delete_element(condition_block);
+    }
+    /* join */
+    else if(word == WORD_JOIN){
+        stack_element * value2 = stack_pop();
+        stack_element * value1 = stack_pop();
+        size_t new_length = strlen((*value1).value) + strlen((*value2).value) + 1;
+        char * new_value = polaris_malloc(sizeof(char) * new_length, MEMORY_STRINGS);
+        strcpy(new_value, (*value1).value);
+        strcat(new_value, (*value2).value);
+        stack_push(new_value, 0, strlen(new_value), false, true);
+        polaris_free(new_value);
+        delete_element(value2);
+        delete_element(value1);
+    }
+    /* spawn */
+    else if(word == WORD_SPAWN){
+        stack_element * block = stack_pop();
+        spawn_task((*block).value, base_path);
+        delete_element(block);
+    }
+    /* send */
+    else if(word == WORD_SEND){
+        stack_element * name = stack_peek();
+        channel * target = get_channel((*name).value);
+        stack_element * value;
+        if((*target).count >= CHANNELCAPACITY){
+            /* Wait until a receiver makes room */
+            return 2;
+        }
+        name = stack_pop();
+        value = stack_pop();
+        (*value).next = null;
+        if((*target).last == null) (*target).first = value;
+        else (*(*target).last).next = value;
+        (*target).last = value;
+        (*target).count++;
+        delete_element(name);
+    }
+    /* recv */
+    else if(word == WORD_RECV){
+        stack_element * name = stack_peek();
+        channel * target = get_channel((*name).value);
+        stack_element * value;
+        if((*target).count == 0){
+            /* Wait until a sender provides a value */
+            return 2;
+        }
+        name = stack_pop();
+        value = (*target).first;
+        (*target).first = (*value).next;
+        if((*target).first == null) (*target).last = null;
+        (*target).count--;
+        stack_push((*value).value, 0, strlen((*value).value), false, true);
+        delete_element(value);
+        delete_element(name);
+    }
+    /* serve */
+    else if(word == WORD_SERVE){
+        stack_element * port = stack_pop();
+        stack_element * handler = stack_pop();
+        char result_s[50];
+        /* The listener keeps the handler's source */
+        sprintf(result_s, "%d", open_listener((*port).value, take_value(handler), base_path));
+        delete_element(port);
+        delete_element(handler);
+        stack_push_text(result_s);
+    }
+    /* connect */
+    else if(word == WORD_CONNECT){
+        stack_element * port = stack_pop();
+        stack_element * host = stack_pop();
+        char result_s[50];
+        sprintf(result_s, "%d", open_connection((*host).value, (*port).value));
+        delete_element(port);
+        delete_element(host);
+        stack_push_text(result_s);
+    }
+    /* read */
+    else if(word == WORD_READ){
+        connection * target = get_connection((*stack_peek()).value);
+        char * line = (*target).inbound + (*target).inbound_start;
+        char * line_end = (*target).inbound_length == 0 ? null
+            : memchr(line, '\n', (*target).inbound_length);
+        size_t line_length;
+        if(line_end == null && !(*target).closed){
+            /* Wait until a whole line has arrived */
+            return 2;
+        }
+        delete_element(stack_pop());
+        line_length = line_end == null ? (*target).inbound_length : (size_t)(line_end - line);
+        (*target).inbound_start += line_end == null ? line_length : line_length + 1;
+        (*target).inbound_length -= line_end == null ? line_length : line_length + 1;
+        if(line_length > 0 && line[line_length - 1] == '\r') line_length--;
+        stack_push(line, 0, line_length, false, true);
+    }
+    /* eof */
+    else if(word == WORD_EOF){
+        connection * target = get_connection((*stack_peek()).value);
+        if((*target).inbound_length == 0 && !(*target).closed){
+            /* Wait until there is something to read or the peer closes */
+            return 2;
+        }
+        delete_element(stack_pop());
+        stack_push_text((*target).inbound_length == 0 ? "1" : "0");
+    }
+    /* write */
+    else if(word == WORD_WRITE){
+        connection * target = get_connection((*stack_peek()).value);
+        stack_element * value;
+        if((*target).outbound_length > MAXPENDINGOUTPUT){
+            /* Wait until the peer catches up */
+            return 2;
+        }
+        delete_element(stack_pop());
+        value = stack_pop();
+        queue_output(target, (*value).value);
+        delete_element(value);
+    }
+    /* close */
+    else if(word == WORD_CLOSE){
+        stack_element * handle = stack_pop();
+        close_connection(get_connection((*handle).value));
+        delete_element(handle);
+    }
+    /* generator */
+    else if(word == WORD_GENERATOR){
+        stack_element * block = stack_pop();
+        char result_s[50];
+        num_to_str(result_s, new_generator((*block).value, base_path));
+        delete_element(block);
+        stack_push_text(result_s);
+    }
+    /* yield */
+    else if(word == WORD_YIELD){
+        if(current_generator == null){
+            error("yield used outside of a generator.");
+        }
+        (*current_generator).yielded = stack_pop();
+    }
+    /* next */
+    else if(word == WORD_NEXT){
+        stack_element * handle = stack_pop();
+        generator * target = get_generator((*handle).value);
+        delete_element(handle);
+        if(resume_generator(target)){
+            stack_element * value = (*target).yielded;
+            (*target).yielded = null;
+            stack_push((*value).value, 0, strlen((*value).value), false, true);
+            delete_element(value);
+            stack_push_text("1");
+        }else{
+            stack_push_text("0");
+        }
+    }
+    /* map */
+    else if(word == WORD_MAP){
+        stack_element * block = stack_pop();
+        stack_element * delimiter = stack_pop();
+        stack_element * list = stack_pop();
+        map_list((*list).value, (*delimiter).value, (*block).value, base_path);
+        delete_element(block);
+        delete_element(delimiter);
+        delete_element(list);
+    }
+    /* copy */
+    else if(word == WORD_COPY){
+        stack_element * value = stack_pop();
+        stack_push((*value).value, 0, strlen((*value).value), false, true);
+        stack_push((*value).value, 0, strlen((*value).value), false, true);
+        delete_element(value);
+    }
+    /* del */
+    else if(word == WORD_DEL){
+        stack_element * value = stack_pop();
+        delete_element(value);
+    }
+    /* swap */
+    else if(word == WORD_SWAP){
+        stack_element * value2 = stack_pop();
+        stack_element * value1 = stack_pop();
+        stack_push((*value2).value, 0, strlen((*value2).value), false, true);
+        stack_push((*value1).value, 0, strlen((*value1).value), false, true);
+        delete_element(value1);
+        delete_element(value2);
+    }
+    /* input */
+    else if(word == WORD_INPUT){
+        return take_input();
+    }
+    /* >var */
+    else if(word == WORD_SET_VAR){
+        stack_element * value = stack_pop();
+        var_element * target = lookup_var((*current_token).text, &(*current_token).variable);
+        if(target != null) assign_var(target, (*value).value);
+        else set_var_value((*current_token).text, (*value).value);
+        delete_element(value);
+    }
+    /* @var */
+    else if(word == WORD_GET_VAR){
+        get_var_value((*current_token).text, &(*current_token).variable);
+    }
+    /* % */
+    else if(word == WORD_CALL){
+        var_element * function = lookup_var((*current_token).text, &(*current_token).variable);
+        code_block * body;
+        if(function == null || show_pushpops){
+            /* Goes through the stack so -p shows the function being pushed */
+            stack_element * value;
+            get_var_value((*current_token).text, null);
+            value = stack_pop();
+            body = compile_block((*value).value);
+            delete_element(value);
+            function = find_var((*current_token).text);
+        }else{
+            if((*function).code == null){
+                (*function).code = compile_block((*function).value);
+                (*(*function).code).references++;
+            }
+            body = (*function).code;
+        }
+        if(profiling && (*body).name == null){
+            (*body).name = copy_string((*current_token).text);
+        }
+        if((*function).memo_inputs >= 0){
+            call_memoized(function, body, base_path);
+        }else{
+            push_frame(FRAME_EVAL, body, null, base_path, false);
+        }
+    }
+    /* random */
+    else if(word == WORD_RANDOM){
+        char result_s[50];
+        num_to_str(result_s, random_fraction());
+        stack_push_text(result_s);
+    }
+    /* seed */
+    else if(word == WORD_SEED){
+        stack_element * value1 = stack_pop();
+        pnumber seed;
+        if(!str_is_num((*value1).value, 0, strlen((*value1).value))){
+            error("trying to seed the random generator with a non-numeric value.");
+        }
+        seed = fmod(fabs(atof((*value1).value)), 4294967296.0);
+        seed_random((unsigned long)seed);
+        delete_element(value1);
+    }
+    /* randint, randints */
+    else if(word == WORD_RANDINT || word == WORD_RANDINTS){
+        stack_element * count = word == WORD_RANDINTS ? stack_pop() : null;
+        stack_element * value2 = stack_pop();
+        stack_element * value1 = stack_pop();
+        char result_s[50];
+        pnumber min = atof((*value1).value);
+        pnumber max = atof((*value2).value);
+        unsigned long values = 1;
+        unsigned long i;
+        if(count != null){
+            if(!str_is_num((*count).value, 0, strlen((*count).value)) || atof((*count).value) < 0){
+                error("trying to generate an invalid number of random values.");
+            }
+            values = (unsigned long)atof((*count).value);
+            delete_element(count);
+        }
+        delete_element(value1);
+        delete_element(value2);
+        for(i = 0; i < values; ++i){
+            num_to_str(result_s, random_integer(min, max));
+            stack_push_text(result_s);
+        }
+    }
+    /* exit */
+    else if(word == WORD_EXIT){
+        return 1;
+    }
+    /* import */
+    else if(word == WORD_IMPORT){
+        stack_element * value = stack_pop();
+        char new_path[512];
+        char * file_contents;
+        resolve_import(new_path, base_path, (*value).value);
+        file_contents = load_source_file(new_path);
+        if(profiling){
+            add_file_origin(file_contents, new_path);
+        }
+        remove_file_name(new_path);
+        push_frame(FRAME_EVAL, compile_block(file_contents), null, copy_string(new_path), true);
+        polaris_free(file_contents);
+        delete_element(value);
+    }
+    /* sleep */
+    else if(word == WORD_SLEEP){
+        stack_element * value1 = stack_pop();
+        if(
+            !str_is_num((*value1).value, 0, strlen((*value1).value))
+        ){
+            error("trying to sleep a non-numerical amount of time.");
+        }
+        if(nested_evaluations == 0 && atof((*value1).value) > 0){
+            /* Let other tasks and timers run in the meantime */
+            (*current_task).sleeping = true;
+            (*current_task).wake_at = polaris_ticks() + (unsigned long)atof((*value1).value);
+        }else{
+            polaris_delay(atof((*value1).value));
+        }
+        delete_element(value1);
+    }
+    /* after */
+    else if(word == WORD_AFTER || word == WORD_EVERY){
+        stack_element * value1 = stack_pop();
+        stack_element * block = stack_pop();
+        char result_s[50];
+        if(
+            !str_is_num((*value1).value, 0, strlen((*value1).value))
+        ){
+            error("trying to set a timer with a non-numerical amount of time.");
+        }
+        /* The timer keeps the block's source */
+        num_to_str(result_s, add_timer(take_value(block), base_path,
+            atof((*value1).value) > 0 ? (unsigned long)atof((*value1).value) : 0,
+            word == WORD_EVERY));
+        delete_element(value1);
+        delete_element(block);
+        stack_push_text(result_s);
+    }
+    /* cancel */
+    else if(word == WORD_CANCEL){
+        stack_element * value1 = stack_pop();
+        if(
+            !str_is_num((*value1).value, 0, strlen((*value1).value))
+        ){
+            error("trying to cancel a timer with a non-numerical id.");
+        }
+        cancel_timer((unsigned long)atof((*value1).value));
+        delete_element(value1);
+    }
+    /* memo */
+    else if(word == WORD_MEMO){
+        stack_element * inputs = stack_pop();
+        stack_element * name = stack_pop();
+        var_element * function = find_var((*name).value);
+        if(
+            !str_is_num((*inputs).value, 0, strlen((*inputs).value))
+            || atof((*inputs).value) < 0
+        ){
+            error("trying to memoize a function with an invalid number of inputs.");
+        }
+        if(function == null){
+            fprintf(program_output, "When trying to memoize variable: %s\r\n", (*name).value);
+            error("variable not found.");
+        }
+        forget_function_memos((*function).name);
+        (*function).memo_inputs = (int)atof((*inputs).value);
+        delete_element(inputs);
+        delete_element(name);
+    }
+    return 0;
+}
+
+void operate(int word, char* value1, char* value2, char* result_s){
+    /* Applies an arithmetic or comparison word to two values */
+    if(is_arithmetic(word)){
+        pnumber result = 0;
+        if(is_integer_text(value1) && is_integer_text(value2) && operate_integers(word, value1, value2, result_s)){
+            return;
+        }
+        if(
+            !str_is_num(value1, 0, strlen(value1))
+            || !str_is_num(value2, 0, strlen(value2))
+        ){
+            error("trying to operate arithmetically with a non-numerical value.");
+        }
+        if((word == WORD_MODULO || word == WORD_DIVIDE_INT) && (pnumber_i)atof(value2) == 0){
+            error("division by zero.");
+        }
+        if(word == WORD_ADD) result = atof(value1) + atof(value2);
+        else if(word == WORD_SUBTRACT) result = atof(value1) - atof(value2);
+        else if(word == WORD_MULTIPLY) result = atof(value1) * atof(value2);
+        else if(word == WORD_DIVIDE) result = atof(value1) / atof(value2);
+        else if(word == WORD_MODULO) result = (pnumber_i)atof(value1) % (pnumber_i)atof(value2);
+        else if(word == WORD_DIVIDE_INT) result = (pnumber_i)(atof(value1) / atof(value2));
+        else if(word == WORD_POWER) result = pow(atof(value1), atof(value2));
+        num_to_str(result_s, result);
+    }else{
+        bool result;
+        if(is_integer_text(value1) && is_integer_text(value2)){
+            int comparison = compare_integers(value1, value2);
+            if(word == WORD_EQUAL) result = comparison == 0;
+            else if(word == WORD_NOT_EQUAL) result = comparison != 0;
+            else if(word == WORD_LESS) result = comparison < 0;
+            else if(word == WORD_GREATER) result = comparison > 0;
+            else if(word == WORD_LESS_EQUAL) result = comparison <= 0;
+            else result = comparison >= 0;
+        }
+        else if(
+            str_is_num(value1, 0, strlen(value1))
+            && str_is_num(value2, 0, strlen(value2))
+        ){
+            pnumber val1 = atof(value1);
+            pnumber val2 = atof(value2);
+            if(word == WORD_EQUAL) result = fabs(val1 - val2) < EPSILON;
+            else if(word == WORD_NOT_EQUAL) result = fabs(val1 - val2) > EPSILON;
+            else if(word == WORD_LESS) result = val1 < val2;
+            else if(word == WORD_GREATER) result = val1 > val2;
+            else if(word == WORD_LESS_EQUAL) result = val1 <= val2;
+            else result = val1 >= val2;
+        }else{
+            int comparison = strcmp(value1, value2);
+            if(word == WORD_EQUAL) result = comparison == 0;
+            else if(word == WORD_NOT_EQUAL) result = comparison != 0;
+            else if(word == WORD_LESS) result = comparison < 0;
+            else if(word == WORD_GREATER) result = comparison > 0;
+            else if(word == WORD_LESS_EQUAL) result = comparison <= 0;
+            else result = comparison >= 0;
+        }
+        strcpy(result_s, result ? "1" : "0");
+    }
+}
+
+void operate_function(int word, char* value, char* result_s){
+    /* Applies sin, cos, tan or log to a value */
+    pnumber number;
+    if(!str_is_num(value, 0, strlen(value))){
+        error("trying to operate arithmetically with a non-numerical value.");
+    }
+    number = atof(value);
+    if(word == WORD_SIN) num_to_str(result_s, sin(number));
+    else if(word == WORD_COS) num_to_str(result_s, cos(number));
+    else if(word == WORD_TAN) num_to_str(result_s, tan(number));
+    else num_to_str(result_s, log(number));
+}
+
+bool is_arithmetic(int word){
+    return word >= WORD_ADD && word <= WORD_POWER;
+}
+
+bool is_comparison(int word){
+    return word == WORD_EQUAL || word == WORD_NOT_EQUAL
+        || (word >= WORD_LESS && word <= WORD_GREATER_EQUAL);
+}
+
+bool is_integer_text(char* value)
+{
+    /* Whether a number is written without a point, so it can be operated on exactly */
+    if(*value == '-') value++;
+    if(*value < '0' || *value > '9') return false;
+    while(*value >= '0' && *value <= '9') value++;
+    return *value == '\0';
+}
+
+bool parse_long(char* value, long * result)
+{
+    /* Reads a whole number if it fits in a long. Each digit is checked
+       before it is added so nothing overflows. */
+    bool negative = *value == '-';
+    long magnitude = 0;
+    if(negative) value++;
+    for(; *value != '\0'; ++value){
+        int digit = *value - '0';
+        if(magnitude > (LONG_MAX - digit) / 10){
+            return false;
+        }
+        magnitude = magnitude * 10 + digit;
+    }
+    *result = negative ? -magnitude : magnitude;
+    return true;
+}
+
+bool operate_integers(int word, char* value1, char* value2, char* result_s)
+{
+    /* Arithmetic on whole numbers without going through doubles. Numbers
+       that fit in a long are operated on directly, longer ones as big
+       integers. Returns false when the result isn't a whole number or is
+       too long, so doubles are used instead. */
+    big_integer big1;
+    big_integer big2;
+    big_integer result;
+    big_integer remainder;
+    long small1;
+    long small2;
+    if(word == WORD_POWER && value2[0] == '-'){
+        return false;
+    }
+    if((word == WORD_MODULO || word == WORD_DIVIDE_INT) && is_zero_text(value2)){
+        error("division by zero.");
+    }
+    if(word == WORD_DIVIDE && is_zero_text(value2)){
+        return false;
+    }
+    if(word != WORD_POWER && parse_long(value1, &small1) && parse_long(value2, &small2)){
+        /* Neither is LONG_MIN, so they can be negated */
+        long magnitude1 = small1 < 0 ? -small1 : small1;
+        long magnitude2 = small2 < 0 ? -small2 : small2;
+        bool fits = true;
+        long small_result = 0;
+        if(word == WORD_ADD){
+            fits = small2 > 0 ? small1 <= LONG_MAX - small2 : small1 >= -LONG_MAX - small2;
+            if(fits) small_result = small1 + small2;
+        }else if(word == WORD_SUBTRACT){
+            fits = small2 < 0 ? small1 <= LONG_MAX + small2 : small1 >= -LONG_MAX + small2;
+            if(fits) small_result = small1 - small2;
+        }else if(word == WORD_MULTIPLY){
+            fits = magnitude1 == 0 || magnitude2 <= LONG_MAX / magnitude1;
+            if(fits) small_result = small1 * small2;
+        }else{
+            /* Quotients are truncated, remainders take the sign of the dividend */
+            long quotient = magnitude1 / magnitude2;
+            if((small1 < 0) != (small2 < 0)) quotient = -quotient;
+            if(word == WORD_DIVIDE && quotient * small2 != small1) return false;
+            small_result = word == WORD_MODULO ? small1 - quotient * small2 : quotient;
+        }
+        if(fits){
+            sprintf(result_s, "%ld", small_result);
+            return true;
+        }
+    }
+    if(!big_from_text(&big1, value1) || !big_from_text(&big2, value2)){
+        return false;
+    }
+    if(word == WORD_ADD){
+        if(!big_add(&result, &big1, &big2)) return false;
+    }else if(word == WORD_SUBTRACT){
+        big2.sign = -big2.sign;
+        if(!big_add(&result, &big1, &big2)) return false;
+    }else if(word == WORD_MULTIPLY){
+        if(!big_multiply(&result, &big1, &big2)) return false;
+    }else if(word == WORD_POWER){
+        if(!big_power(&result, &big1, &big2)) return false;
+    }else{
+        big_divide(&result, &remainder, &big1, &big2);
+        if(word == WORD_DIVIDE && remainder.length != 0) return false;
+        if(word == WORD_MODULO) result = remainder;
+    }
+    big_to_text(&result, result_s);
+    return true;
+}
+
+bool is_zero_text(char* value)
+{
+    if(*value == '-') value++;
+    while(*value == '0') value++;
+    return *value == '\0';
+}
+
+int compare_integers(char* value1, char* value2)
+{
+    /* Compares two whole numbers exactly, returns -1, 0 or 1 */
+    int sign1 = value1[0] == '-' && !is_zero_text(value1) ? -1 : 1;
+    int sign2 = value2[0] == '-' && !is_zero_text(value2) ? -1 : 1;
+    size_t length1;
+    size_t length2;
+    int comparison;
+    if(sign1 != sign2){
+        return sign1;
+    }
+    if(*value1 == '-') value1++;
+    if(*value2 == '-') value2++;
+    while(*value1 == '0' && value1[1] != '\0') value1++;
+    while(*value2 == '0' && value2[1] != '\0') value2++;
+    length1 = strlen(value1);
+    length2 = strlen(value2);
+    if(length1 != length2){
+        comparison = length1 < length2 ? -1 : 1;
+    }else{
+        comparison = strcmp(value1, value2);
+        comparison = comparison < 0 ? -1 : (comparison > 0 ? 1 : 0);
+    }
+    return comparison * sign1;
+}
+
+void normalize_integer(char* destination, char* value)
+{
+    /* Writes a whole number without leading zeros or a negative zero */
+    bool negative = *value == '-';
+    if(negative) value++;
+    while(*value == '0' && value[1] != '\0') value++;
+    if(negative && *value != '0') *destination++ = '-';
+    strcpy(destination, value);
+}
+
+bool big_from_text(big_integer * target, char* text)
+{
+    /* Reads a whole number four digits per limb, from the last digit. Returns false if it is too long. */
+    size_t length;
+    size_t end;
+    (*target).sign = 1;
+    if(*text == '-'){
+        (*target).sign = -1;
+        text++;
+    }
+    while(*text == '0') text++;
+    length = strlen(text);
+    if(length > BIGLIMBS * 4){
+        return false;
+    }
+    (*target).length = 0;
+    for(end = length; end > 0; end = end > 4 ? end - 4 : 0){
+        size_t start = end > 4 ? end - 4 : 0;
+        int limb = 0;
+        size_t i;
+        for(i = start; i < end; ++i){
+            limb = limb * 10 + (text[i] - '0');
+        }
+        (*target).limbs[(*target).length++] = limb;
+    }
+    if((*target).length == 0) (*target).sign = 1;
+    return true;
+}
+
+void big_to_text(big_integer * source, char* destination)
+{
+    int i;
+    if((*source).length == 0){
+        strcpy(destination, "0");
+        return;
+    }
+    if((*source).sign < 0) *destination++ = '-';
+    destination += sprintf(destination, "%d", (*source).limbs[(*source).length - 1]);
+    for(i = (*source).length - 2; i >= 0; --i){
+        destination += sprintf(destination, "%04d", (*source).limbs[i]);
+    }
+}
+
+int big_compare(big_integer * a, big_integer * b)
+{
+    /* Compares the magnitudes, returns -1, 0 or 1 */
+    int i;
+    if((*a).length != (*b).length){
+        return (*a).length < (*b).length ? -1 : 1;
+    }
+    for(i = (*a).length - 1; i >= 0; --i){
+        if((*a).limbs[i] != (*b).limbs[i]){
+            return (*a).limbs[i] < (*b).limbs[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+bool big_add(big_integer * result, big_integer * a, big_integer * b)
+{
+    /* Adds with signs. result may be a or b. Returns false if it doesn't fit. */
+    int i;
+    if((*a).sign == (*b).sign){
+        int length = (*a).length > (*b).length ? (*a).length : (*b).length;
+        int carry = 0;
+        for(i = 0; i < length; ++i){
+            int sum = carry;
+            if(i < (*a).length) sum += (*a).limbs[i];
+            if(i < (*b).length) sum += (*b).limbs[i];
+            (*result).limbs[i] = sum % 10000;
+            carry = sum / 10000;
+        }
+        if(carry > 0){
+            if(length == BIGLIMBS) return false;
+            (*result).limbs[length++] = carry;
+        }
+        (*result).sign = (*a).sign;
+        (*result).length = length;
+    }else{
+        big_integer * larger = a;
+        big_integer * smaller = b;
+        int borrow = 0;
+        int sign;
+        if(big_compare(a, b) < 0){
+            larger = b;
+            smaller = a;
+        }
+        sign = (*larger).sign;
+        for(i = 0; i < (*larger).length; ++i){
+            int difference = (*larger).limbs[i] - borrow - (i < (*smaller).length ? (*smaller).limbs[i] : 0);
+            borrow = difference < 0;
+            (*result).limbs[i] = borrow ? difference + 10000 : difference;
+        }
+        (*result).length = (*larger).length;
+        (*result).sign = sign;
+        big_trim(result);
+    }
+    return true;
+}
+
+bool big_multiply(big_integer * result, big_integer * a, big_integer * b)
+{
+    /* Schoolbook multiplication, a limb of a at a time. result may be a or b. */
+    int product[2 * BIGLIMBS];
+    int length = (*a).length + (*b).length;
+    int i;
+    int j;
+    for(i = 0; i < length; ++i){
+        product[i] = 0;
+    }
+    for(i = 0; i < (*a).length; ++i){
+        long carry = 0;
+        for(j = 0; j < (*b).length; ++j){
+            long sum = product[i + j] + (long)(*a).limbs[i] * (*b).limbs[j] + carry;
+            product[i + j] = (int)(sum % 10000);
+            carry = sum / 10000;
+        }
+        product[i + (*b).length] = (int)carry;
+    }
+    while(length > 0 && product[length - 1] == 0){
+        length--;
+    }
+    if(length > BIGLIMBS){
+        return false;
+    }
+    (*result).sign = (*a).sign * (*b).sign;
+    (*result).length = length;
+    for(i = 0; i < length; ++i){
+        (*result).limbs[i] = product[i];
+    }
+    big_trim(result);
+    return true;
+}
+
+void big_divide(big_integer * quotient, big_integer * remainder, big_integer * a, big_integer * b)
+{
+    /* Long division a limb at a time, the limb of the quotient found by
+       bisection. The quotient is truncated and the remainder takes the sign of a. */
+    big_integer divisor = *b;
+    int i;
+    divisor.sign = 1;
+    (*remainder).length = 0;
+    (*remainder).sign = 1;
+    (*quotient).length = (*a).length;
+    for(i = (*a).length - 1; i >= 0; --i){
+        big_integer multiple;
+        int low = 0;
+        int high = 9999;
+        int j;
+        /* remainder = remainder * 10000 + next limb */
+        for(j = (*remainder).length; j > 0; --j){
+            (*remainder).limbs[j] = (*remainder).limbs[j - 1];
+        }
+        (*remainder).limbs[0] = (*a).limbs[i];
+        (*remainder).length++;
+        big_trim(remainder);
+        while(low < high){
+            int middle = (low + high + 1) / 2;
+            big_multiply_small(&multiple, &divisor, middle);
+            if(big_compare(&multiple, remainder) <= 0) low = middle;
+            else high = middle - 1;
+        }
+        (*quotient).limbs[i] = low;
+        if(low > 0){
+            big_multiply_small(&multiple, &divisor, low);
+            multiple.sign = -1;
+            big_add(remainder, remainder, &multiple);
+            (*remainder).sign = 1;
+        }
+    }
+    (*quotient).sign = (*a).sign * (*b).sign;
+    (*remainder).sign = (*a).sign;
+    big_trim(quotient);
+    big_trim(remainder);
+}
+
+void big_multiply_small(big_integer * result, big_integer * a, int factor)
+{
+    /* Multiplies the magnitude of a by a factor below 10000. The result
+       can be a limb longer than a, which the division leaves room for. */
+    long carry = 0;
+    int i;
+    for(i = 0; i < (*a).length; ++i){
+        long product = (long)(*a).limbs[i] * factor + carry;
+        (*result).limbs[i] = (int)(product % 10000);
+        carry = product / 10000;
+    }
+    (*result).length = (*a).length;
+    if(carry > 0) (*result).limbs[(*result).length++] = (int)carry;
+    (*result).sign = 1;
+    big_trim(result);
+}
+
+bool big_power(big_integer * result, big_integer * base, big_integer * exponent)
+{
+    /* Square and multiply, with the bits of the exponent read from a copy
+       halved each time. Returns false if the result doesn't fit. */
+    big_integer square = *base;
+    big_integer remaining = *exponent;
+    (*result).sign = 1;
+    (*result).length = 1;
+    (*result).limbs[0] = 1;
+    while(remaining.length > 0){
+        int carry = 0;
+        int i;
+        bool odd = remaining.limbs[0] % 2 == 1;
+        for(i = remaining.length - 1; i >= 0; --i){
+            int value = carry * 10000 + remaining.limbs[i];
+            remaining.limbs[i] = value / 2;
+            carry = value % 2;
+        }
+        big_trim(&remaining);
+        if(odd && !big_multiply(result, result, &square)) return false;
+        if(remaining.length > 0 && !big_multiply(&square, &square, &square)) return false;
+    }
+    return true;
+}
+
+void big_trim(big_integer * target)
+{
+    /* Drops leading zero limbs, zero has no sign */
+    while((*target).length > 0 && (*target).limbs[(*target).length - 1] == 0){
+        (*target).length--;
+    }
+    if((*target).length == 0) (*target).sign = 1;
+}
+
+void set_var_value(char* var, char* value){
+    var_element * current_var = find_var(var);
+    if(current_var == null){
+        size_t name_length = strlen(var)+1;
+        frame * current_frame = frames;
+        if(free_variables != null){
+            current_var = free_variables;
+            free_variables = (*current_var).next;
+            free_variable_count--;
+            if(memory_size((*current_var).name) < name_length){
+                (*current_var).name = polaris_realloc((*current_var).name, sizeof(char) * name_length, MEMORY_VARIABLES);
+            }
+        }else{
+            current_var = polaris_malloc(sizeof(var_element), MEMORY_VARIABLES);
+            (*current_var).name = polaris_malloc(sizeof(char) * name_length, MEMORY_VARIABLES);
+        }
+        (*current_var).next = variables;
+        strcpy((*current_var).name, var);
+        (*current_var).value = null;
+        (*current_var).code = null;
+        (*current_var).memo_inputs = -1;
+        (*current_var).scope = 0;
+        while(current_frame != null && (*current_frame).kind != FRAME_SCOPE){
+            current_frame = (*current_frame).next;
+        }
+        if(current_frame != null) (*current_var).scope = (*current_frame).scope;
+        variables = current_var;
+        variable_count++;
+        variables_generation++;
+    }
+    assign_var(current_var, value);
+}
+
+void assign_var(var_element * target, char* value){
+    size_t string_length;
+    if((*target).value != null) polaris_free((*target).value);
+    if((*target).code != null){
+        release_block((*target).code);
+        (*target).code = null;
+    }
+    if((*target).memo_inputs >= 0){
+        /* Results of the old function no longer hold */
+        forget_function_memos((*target).name);
+    }
+    string_length = strlen(value)+1;
+    (*target).value = polaris_malloc(sizeof(char) * string_length, MEMORY_VARIABLES);
+    strcpy((*target).value, value);
+}
+
+void get_var_value(char* var, var_cache * cache){
+    var_element * current_var = lookup_var(var, cache);
+    if(current_var != null){
+        stack_push((*current_var).value, 0, strlen((*current_var).value), true, true);
+        return;
+    }
+    fprintf(program_output, "When trying to get variable: %s\r\n", var);
+    error("variable not found.");
+}
+
+void unset_var(char* var){
+    /* Deletes a variable */
+    var_element * target = find_var(var);
+    if(target == null){
+        fprintf(program_output, "When trying to unset variable: %s\r\n", var);
+        error("variable not found.");
+    }
+    delete_var(target);
+}
+
+void unset_prefix(char* prefix){
+    /* Deletes every variable whose name starts with prefix */
+    size_t length = strlen(prefix);
+    var_element * current_var = variables;
+    while(current_var != null){
+        var_element * next = (*current_var).next;
+        if(strncmp((*current_var).name, prefix, length) == 0){
+            delete_var(current_var);
+        }
+        current_var = next;
+    }
+}
+
+void delete_var(var_element * target){
+    /* Removes a variable. Its element is kept for the next new variable
+       while fewer are kept than there are variables. */
+    var_element ** link = &variables;
+    while(*link != target){
+        link = &(**link).next;
+    }
+    *link = (*target).next;
+    if((*target).memo_inputs >= 0) forget_function_memos((*target).name);
+    if((*target).code != null) release_block((*target).code);
+    polaris_free((*target).value);
+    variable_count--;
+    variables_generation++;
+    if(free_variable_count < variable_count){
+        (*target).next = free_variables;
+        free_variables = target;
+        free_variable_count++;
+    }else{
+        polaris_free((*target).name);
+        polaris_free(target);
+    }
+}
+
+void delete_scope_variables(unsigned long scope){
+    /* Deletes the variables created while a scope frame ran */
+    var_element * current_var = variables;
+    while(current_var != null){
+        var_element * next = (*current_var).next;
+        if((*current_var).scope == scope){
+            delete_var(current_var);
+        }
+        current_var = next;
+    }
+}
+
+var_element * find_var(char* var){
+    var_element * current_var = variables;
+    while(current_var != null){
+        if(strcmp((*current_var).name, var) == 0){
+            return current_var;
+        }
+        else current_var = (*current_var).next;
+    }
+    return null;
+}
+
+var_element * lookup_var(char* var, var_cache * cache){
+    /* Finds a variable for a call site. The variable found last time is
+       used again as long as no variable has been added or removed since. */
+    var_element * found;
+    if(cache == null){
+        return find_var(var);
+    }
+    if((*cache).var != null && (*cache).generation == variables_generation){
+        return (*cache).var;
+    }
+    found = find_var(var);
+    (*cache).var = found;
+    (*cache).generation = variables_generation;
+    return found;
+}
+
+void call_memoized(var_element * function, code_block * body, char* base_path){
+    /* Calls a memoized function. If it has already been called with the same
+       inputs, its inputs are replaced by the values it left then. Otherwise
+       it is evaluated on a stack that holds only its inputs, so it can
+       neither see nor disturb the caller's values, and what it leaves is
+       remembered by finish_memoized. */
+    stack_element * last_input = null;
+    stack_element * current_input = stack;
+    size_t key_length = strlen((*function).name) + 24;
+    char * key;
+    unsigned long hash;
+    memo_entry * entry;
+    int i;
+    for(i = 0; i < (*function).memo_inputs; ++i){
+        if(current_input == null){
+            error("cannot pop from an empty stack.");
+        }
+        key_length += strlen((*current_input).value) + 24;
+        last_input = current_input;
+        current_input = (*current_input).next;
+    }
+    /* Every part is prefixed by its length so no two sets of inputs look alike */
+    key = polaris_malloc(sizeof(char) * key_length, MEMORY_OTHER);
+    sprintf(key, "%lu:%s", (unsigned long)strlen((*function).name), (*function).name);
+    current_input = stack;
+    for(i = 0; i < (*function).memo_inputs; ++i){
+        sprintf(key + strlen(key), ":%lu:%s", (unsigned long)strlen((*current_input).value), (*current_input).value);
+        current_input = (*current_input).next;
+    }
+    hash = hash_string(key);
+    entry = find_memo(key, hash);
+    if(entry != null){
+        size_t j;
+        memo_hits++;
+        polaris_free(key);
+        for(i = 0; i < (*function).memo_inputs; ++i){
+            delete_element(stack_pop());
+        }
+        for(j = 0; j < (*entry).output_count; ++j){
+            stack_push((*entry).outputs[j], 0, strlen((*entry).outputs[j]), false, true);
+        }
+        return;
+    }
+    memo_misses++;
+    push_frame(FRAME_MEMO, body, null, base_path, false);
+    (*frames).key = key;
+    /* Detach the inputs from the caller's stack */
+    if(last_input == null){
+        (*frames).saved_stack = stack;
+        stack = null;
+    }else{
+        (*frames).saved_stack = (*last_input).next;
+        (*last_input).next = null;
+    }
+}
+
+void finish_memoized(frame * current){
+    /* Remembers the values a memoized function left and puts them back on
+       top of its caller's stack */
+    memo_entry * entry;
+    stack_element * output = stack;
+    size_t output_count = 0;
+    size_t bucket;
+    char * name;
+    size_t name_length = (size_t)strtoul((*current).key, &name, 10);
+    while(output != null){
+        output_count++;
+        output = (*output).next;
+    }
+    if(memo_count >= MEMOCACHE){
+        forget_memo(oldest_memo);
+    }
+    entry = polaris_malloc(sizeof(memo_entry), MEMORY_OTHER);
+    (*entry).key = (*current).key;
+    (*current).key = null;
+    (*entry).hash = hash_string((*entry).key);
+    (*entry).function = polaris_malloc(sizeof(char) * (name_length + 1), MEMORY_OTHER);
+    strncpy((*entry).function, name + 1, name_length);
+    (*entry).function[name_length] = '\0';
+    (*entry).output_count = output_count;
+    (*entry).outputs = polaris_malloc(sizeof(char *) * (output_count + 1), MEMORY_OTHER);
+    output = stack;
+    while(output_count > 0){
+        output_count--;
+        (*entry).outputs[output_count] = copy_string((*output).value);
+        if((*output).next == null){
+            /* Join the outputs with the caller's stack */
+            (*output).next = (*current).saved_stack;
+            (*current).saved_stack = null;
+            break;
+        }
+        output = (*output).next;
+    }
+    if(stack == null){
+        stack = (*current).saved_stack;
+        (*current).saved_stack = null;
+    }
+    bucket = (*entry).hash % MEMOCACHE;
+    (*entry).next = memo_entries[bucket];
+    memo_entries[bucket] = entry;
+    (*entry).newer = null;
+    (*entry).older = newest_memo;
+    if(newest_memo != null) (*newest_memo).newer = entry;
+    newest_memo = entry;
+    if(oldest_memo == null) oldest_memo = entry;
+    memo_count++;
+}
+
+memo_entry * find_memo(char* key, unsigned long hash){
+    /* Finds a remembered result and marks it as the most recently used */
+    memo_entry * entry = memo_entries[hash % MEMOCACHE];
+    while(entry != null){
+        if((*entry).hash == hash && strcmp((*entry).key, key) == 0){
+            break;
+        }
+        entry = (*entry).next;
+    }
+    if(entry != null && entry != newest_memo){
+        (*(*entry).newer).older = (*entry).older;
+        if((*entry).older != null) (*(*entry).older).newer = (*entry).newer;
+        else oldest_memo = (*entry).newer;
+        (*entry).older = newest_memo;
+        (*entry).newer = null;
+        (*newest_memo).newer = entry;
+        newest_memo = entry;
+    }
+    return entry;
+}
+
+void forget_memo(memo_entry * entry){
+    memo_entry ** link = &memo_entries[(*entry).hash % MEMOCACHE];
+    size_t i;
+    while(*link != entry){
+        link = &(**link).next;
+    }
+    *link = (*entry).next;
+    if((*entry).newer != null) (*(*entry).newer).older = (*entry).older;
+    else newest_memo = (*entry).older;
+    if((*entry).older != null) (*(*entry).older).newer = (*entry).newer;
+    else oldest_memo = (*entry).newer;
+    for(i = 0; i < (*entry).output_count; ++i){
+        polaris_free((*entry).outputs[i]);
+    }
+    polaris_free((*entry).outputs);
+    polaris_free((*entry).function);
+    polaris_free((*entry).key);
+    polaris_free(entry);
+    memo_count--;
+}
+
+void forget_function_memos(char* function){
+    /* Forgets every result remembered for a function */
+    memo_entry * entry = newest_memo;
+    while(entry != null){
+        memo_entry * older = (*entry).older;
+        if(strcmp((*entry).function, function) == 0){
+            forget_memo(entry);
+        }
+        entry = older;
+    }
+}
+
+regex * compile_regex(char* pattern)
+{
+    /* Returns the compiled form of pattern. Patterns are only compiled the
+       first time they are seen, after that they come from the cache. */
+    unsigned long hash = hash_string(pattern);
+    regex * compiled = compiled_regexes[hash % REGEXCACHE];
+    size_t position = 0;
+    int slots;
+    int i;
+    while(compiled != null){
+        if((*compiled).hash == hash && strcmp((*compiled).pattern, pattern) == 0){
+            return compiled;
+        }
+        compiled = (*compiled).next;
+    }
+    if(compiled_regex_count >= REGEXCACHE){
+        clear_regexes();
+    }
+    compiled = polaris_malloc(sizeof(regex), MEMORY_CODE);
+    (*compiled).pattern = copy_string(pattern);
+    (*compiled).hash = hash;
+    (*compiled).program = null;
+    (*compiled).length = 0;
+    (*compiled).capacity = 0;
+    (*compiled).classes = null;
+    (*compiled).class_count = 0;
+    (*compiled).groups = 1;
+    (*compiled).first = -1;
+    (*compiled).anchored = false;
+    (*compiled).threads = null;
+    (*compiled).thread_captures = null;
+    (*compiled).stack = null;
+    (*compiled).stack_captures = null;
+    (*compiled).marks = null;
+    (*compiled).generation = 0;
+    emit_regex(compiled, REGEX_SAVE, 0, 0);
+    parse_regex_alternation(compiled, pattern, &position);
+    if(pattern[position] != '\0'){
+        regex_error(pattern, "unmatched ) in regular expression.");
+    }
+    emit_regex(compiled, REGEX_SAVE, 1, 0);
+    emit_regex(compiled, REGEX_MATCH, 0, 0);
+    /* Matches that can only start in one place, or with one character, don't need to be looked for everywhere */
+    for(i = 0; (*compiled).program[i].kind == REGEX_SAVE; ++i);
+    if((*compiled).program[i].kind == REGEX_START) (*compiled).anchored = true;
+    if((*compiled).program[i].kind == REGEX_CHAR) (*compiled).first = (*compiled).program[i].argument;
+    /* Working space for matching, kept for every run */
+    slots = 2 * (*compiled).groups;
+    (*compiled).threads = polaris_malloc(sizeof(int) * 2 * (*compiled).length, MEMORY_CODE);
+    (*compiled).thread_captures = polaris_malloc(sizeof(long) * 2 * (*compiled).length * slots, MEMORY_CODE);
+    (*compiled).stack = polaris_malloc(sizeof(int) * (2 * (*compiled).length + 2), MEMORY_CODE);
+    (*compiled).stack_captures = polaris_malloc(sizeof(long) * (2 * (*compiled).length + 2) * slots, MEMORY_CODE);
+    (*compiled).marks = polaris_malloc(sizeof(unsigned long) * (*compiled).length, MEMORY_CODE);
+    for(i = 0; i < (*compiled).length; ++i){
+        (*compiled).marks[i] = 0;
+    }
+    (*compiled).next = compiled_regexes[hash % REGEXCACHE];
+    compiled_regexes[hash % REGEXCACHE] = compiled;
+    compiled_regex_count++;
+    return compiled;
+}
+
+void clear_regexes()
+{
+    /* Frees every cached pattern. Patterns are only used while a word runs,
+       so none of them can be in use. */
+    size_t bucket;
+    for(bucket = 0; bucket < REGEXCACHE; ++bucket){
+        while(compiled_regexes[bucket] != null){
+            regex * compiled = compiled_regexes[bucket];
+            compiled_regexes[bucket] = (*compiled).next;
+            polaris_free((*compiled).pattern);
+            polaris_free((*compiled).program);
+            polaris_free((*compiled).classes);
+            polaris_free((*compiled).threads);
+            polaris_free((*compiled).thread_captures);
+            polaris_free((*compiled).stack);
+            polaris_free((*compiled).stack_captures);
+            polaris_free((*compiled).marks);
+            polaris_free(compiled);
+        }
+    }
+    compiled_regex_count = 0;
+}
+
+void regex_error(char* pattern, char* message)
+{
+    fprintf(program_output, "When compiling regular expression: %s\r\n", pattern);
+    error(message);
+}
+
+int emit_regex(regex * compiled, int kind, int argument, int target)
+{
+    /* Adds an instruction to the end of the program, returns where it is */
+    if((*compiled).length >= MAXREGEXLENGTH){
+        regex_error((*compiled).pattern, "regular expression too long.");
+    }
+    if((*compiled).length == (*compiled).capacity){
+        (*compiled).capacity = (*compiled).capacity == 0 ? 16 : (*compiled).capacity * 2;
+        (*compiled).program = polaris_realloc((*compiled).program,
+            sizeof(regex_instruction) * (*compiled).capacity, MEMORY_CODE);
+    }
+    (*compiled).program[(*compiled).length].kind = kind;
+    (*compiled).program[(*compiled).length].argument = argument;
+    (*compiled).program[(*compiled).length].target = target;
+    (*compiled).program[(*compiled).length].alternate = 0;
+    return (*compiled).length++;
+}
+
+void parse_regex_alternation(regex * compiled, char* pattern, size_t * position)
+{
+    /* a|b|c: a split in front of every choice but the last one, and a jump
+       past the rest at the end of each. The jumps are chained through their
+       targets until the end is known. */
+    int start = (*compiled).length;
+    int pending = -1;
+    parse_regex_sequence(compiled, pattern, position);
+    while(pattern[*position] == '|'){
+        int i;
+        (*position)++;
+        emit_regex(compiled, REGEX_SPLIT, 0, 0);
+        memmove(&(*compiled).program[start + 1], &(*compiled).program[start],
+            sizeof(regex_instruction) * ((*compiled).length - start - 1));
+        for(i = start + 1; i < (*compiled).length; ++i){
+            /* Jumps within the choice move with it, loops back to its first instruction too */
+            regex_instruction * moved = &(*compiled).program[i];
+            if(((*moved).kind == REGEX_SPLIT || (*moved).kind == REGEX_JUMP) && (*moved).target >= start) (*moved).target++;
+            if((*moved).kind == REGEX_SPLIT && (*moved).alternate >= start) (*moved).alternate++;
+        }
+        (*compiled).program[start].kind = REGEX_SPLIT;
+        (*compiled).program[start].target = start + 1;
+        pending = emit_regex(compiled, REGEX_JUMP, 0, pending);
+        (*compiled).program[start].alternate = (*compiled).length;
+        start = (*compiled).length;
+        parse_regex_sequence(compiled, pattern, position);
+    }
+    while(pending != -1){
+        int next = (*compiled).program[pending].target;
+        (*compiled).program[pending].target = (*compiled).length;
+        pending = next;
+    }
+}
+
+void parse_regex_sequence(regex * compiled, char* pattern, size_t * position)
+{
+    /* Atoms, each followed by any number of *, +, ? or {min,max} */
+    while(pattern[*position] != '\0' && pattern[*position] != '|' && pattern[*position] != ')'){
+        int start = (*compiled).length;
+        parse_regex_atom(compiled, pattern, position);
+        for(;;){
+            char current = pattern[*position];
+            int min;
+            int max;
+            if(current == '*'){
+                min = 0;
+                max = -1;
+            }else if(current == '+'){
+                min = 1;
+                max = -1;
+            }else if(current == '?'){
+                min = 0;
+                max = 1;
+            }else if(current == '{' && pattern[*position + 1] >= '0' && pattern[*position + 1] <= '9'){
+                (*position)++;
+                min = (int)strtol(pattern + *position, null, 10);
+                max = min;
+                while(pattern[*position] >= '0' && pattern[*position] <= '9') (*position)++;
+                if(pattern[*position] == ','){
+                    (*position)++;
+                    max = -1;
+                    if(pattern[*position] >= '0' && pattern[*position] <= '9'){
+                        max = (int)strtol(pattern + *position, null, 10);
+                        while(pattern[*position] >= '0' && pattern[*position] <= '9') (*position)++;
+                    }
+                }
+                if(pattern[*position] != '}' || (max >= 0 && max < min) || min > MAXREGEXLENGTH || max > MAXREGEXLENGTH){
+                    regex_error(pattern, "invalid repetition in regular expression.");
+                }
+            }else{
+                break;
+            }
+            (*position)++;
+            repeat_regex(compiled, start, min, max);
+        }
+    }
+}
+
+void parse_regex_atom(regex * compiled, char* pattern, size_t * position)
+{
+    char current = pattern[*position];
+    (*position)++;
+    if(current == '('){
+        int group = (*compiled).groups++;
+        if(group >= MAXCAPTURES){
+            regex_error(pattern, "too many groups in regular expression.");
+        }
+        emit_regex(compiled, REGEX_SAVE, 2 * group, 0);
+        parse_regex_alternation(compiled, pattern, position);
+        if(pattern[*position] != ')'){
+            regex_error(pattern, "unmatched ( in regular expression.");
+        }
+        (*position)++;
+        emit_regex(compiled, REGEX_SAVE, 2 * group + 1, 0);
+    }
+    else if(current == '['){
+        unsigned char * members = new_regex_class(compiled);
+        bool negated = false;
+        int i;
+        if(pattern[*position] == '^'){
+            negated = true;
+            (*position)++;
+        }
+        do{
+            int from = (unsigned char)pattern[*position];
+            int to;
+            if(from == '\0'){
+                regex_error(pattern, "unmatched [ in regular expression.");
+            }
+            (*position)++;
+            if(from == '\\'){
+                from = (unsigned char)pattern[(*position)++];
+                if(from == '\0' || add_regex_escape(members, from)){
+                    if(from == '\0') regex_error(pattern, "unmatched [ in regular expression.");
+                    continue;
+                }
+                from = regex_escape_char(from);
+            }
+            to = from;
+            if(pattern[*position] == '-' && pattern[*position + 1] != ']' && pattern[*position + 1] != '\0'){
+                (*position)++;
+                to = (unsigned char)pattern[(*position)++];
+                if(to == '\\'){
+                    if(pattern[*position] == '\0') regex_error(pattern, "unmatched [ in regular expression.");
+                    to = regex_escape_char((unsigned char)pattern[(*position)++]);
+                }
+            }
+            for(i = from; i <= to; ++i){
+                members[i / 8] |= 1 << (i % 8);
+            }
+        }while(pattern[*position] != ']');
+        (*position)++;
+        if(negated){
+            for(i = 0; i < 32; ++i){
+                members[i] = ~members[i];
+            }
+        }
+        emit_regex(compiled, REGEX_CLASS, (*compiled).class_count - 1, 0);
+    }
+    else if(current == '.') emit_regex(compiled, REGEX_ANY, 0, 0);
+    else if(current == '^') emit_regex(compiled, REGEX_START, 0, 0);
+    else if(current == '$') emit_regex(compiled, REGEX_END, 0, 0);
+    else if(current == '\\'){
+        int escaped = (unsigned char)pattern[*position];
+        if(escaped == '\0'){
+            regex_error(pattern, "regular expression ends with \\.");
+        }
+        (*position)++;
+        if(escaped == 'd' || escaped == 'D' || escaped == 'w' || escaped == 'W' || escaped == 's' || escaped == 'S'){
+            add_regex_escape(new_regex_class(compiled), escaped);
+            emit_regex(compiled, REGEX_CLASS, (*compiled).class_count - 1, 0);
+        }else{
+            emit_regex(compiled, REGEX_CHAR, regex_escape_char(escaped), 0);
+        }
+    }
+    else if(current == '*' || current == '+' || current == '?'){
+        regex_error(pattern, "nothing to repeat in regular expression.");
+    }
+    else emit_regex(compiled, REGEX_CHAR, (unsigned char)current, 0);
+}
+
+void repeat_regex(regex * compiled, int start, int min, int max)
+{
+    /* Replaces the atom at the end of the program by min copies of it
+       followed by max - min optional ones, or a loop if max is -1 */
+    int size = (*compiled).length - start;
+    regex_instruction * atom = polaris_malloc(sizeof(regex_instruction) * size, MEMORY_CODE);
+    int last = start;
+    int pending = -1;
+    int i;
+    memcpy(atom, &(*compiled).program[start], sizeof(regex_instruction) * size);
+    (*compiled).length = start;
+    for(i = 0; i < min; ++i){
+        last = (*compiled).length;
+        copy_regex(compiled, atom, size, start);
+    }
+    if(max < 0 && min > 0){
+        int loop = emit_regex(compiled, REGEX_SPLIT, 0, last);
+        (*compiled).program[loop].alternate = loop + 1;
+    }
+    else if(max < 0){
+        int loop = emit_regex(compiled, REGEX_SPLIT, 0, 0);
+        (*compiled).program[loop].target = loop + 1;
+        copy_regex(compiled, atom, size, start);
+        emit_regex(compiled, REGEX_JUMP, 0, loop);
+        (*compiled).program[loop].alternate = (*compiled).length;
+    }
+    else{
+        for(i = min; i < max; ++i){
+            int skip = emit_regex(compiled, REGEX_SPLIT, 0, 0);
+            (*compiled).program[skip].target = skip + 1;
+            (*compiled).program[skip].alternate = pending;
+            pending = skip;
+            copy_regex(compiled, atom, size, start);
+        }
+        while(pending != -1){
+            int next = (*compiled).program[pending].alternate;
+            (*compiled).program[pending].alternate = (*compiled).length;
+            pending = next;
+        }
+    }
+    polaris_free(atom);
+}
+
+void copy_regex(regex * compiled, regex_instruction * atom, int size, int start)
+{
+    /* Appends a copy of instructions that were at start, moving the jumps along */
+    int offset = (*compiled).length - start;
+    int i;
+    for(i = 0; i < size; ++i){
+        int at = emit_regex(compiled, atom[i].kind, atom[i].argument, atom[i].target);
+        if(atom[i].kind == REGEX_SPLIT || atom[i].kind == REGEX_JUMP){
+            (*compiled).program[at].target += offset;
+        }
+        if(atom[i].kind == REGEX_SPLIT){
+            (*compiled).program[at].alternate = atom[i].alternate + offset;
+        }
+    }
+}
+
+unsigned char * new_regex_class(regex * compiled)
+{
+    /* Adds an empty class and returns its members, a bit per character */
+    unsigned char * members;
+    int i;
+    (*compiled).classes = polaris_realloc((*compiled).classes,
+        sizeof(unsigned char) * 32 * ((*compiled).class_count + 1), MEMORY_CODE);
+    members = (*compiled).classes + 32 * (*compiled).class_count;
+    (*compiled).class_count++;
+    for(i = 0; i < 32; ++i){
+        members[i] = 0;
+    }
+    return members;
+}
+
+bool add_regex_escape(unsigned char * members, int escaped)
+{
+    /* Adds the characters of \d, \w, \s or their opposites to a class */
+    int i;
+    int lowered = escaped | 32;
+    if(lowered != 'd' && lowered != 'w' && lowered != 's'){
+        return false;
+    }
+    for(i = 0; i < 256; ++i){
+        bool member;
+        if(lowered == 'd') member = i >= '0' && i <= '9';
+        else if(lowered == 'w') member = (i >= '0' && i <= '9') || (i >= 'a' && i <= 'z') || (i >= 'A' && i <= 'Z') || i == '_';
+        else member = i == ' ' || i == '\t' || i == '\n' || i == '\r' || i == '\v' || i == '\f';
+        if(escaped != lowered) member = !member;
+        if(member) members[i / 8] |= 1 << (i % 8);
+    }
+    return true;
+}
+
+int regex_escape_char(int escaped)
+{
+    if(escaped == 'n') return '\n';
+    if(escaped == 'r') return '\r';
+    if(escaped == 't') return '\t';
+    return escaped;
+}
+
+bool run_regex(regex * compiled, char* text, size_t length, size_t start, bool whole, long * found)
+{
+    /* Looks for the first match in text from start, or for a match of all of
+       it with whole. Every thread of the program moves a character at a time
+       in step with the others, so the time grows with the text and never
+       explodes. Threads are kept in order of priority, which gives the match
+       a backtracking engine would find. */
+    int slots = 2 * (*compiled).groups;
+    int * current = (*compiled).threads;
+    int * following = (*compiled).threads + (*compiled).length;
+    long * current_captures = (*compiled).thread_captures;
+    long * following_captures = (*compiled).thread_captures + (*compiled).length * slots;
+    int current_count = 0;
+    int following_count;
+    long empty[2 * MAXCAPTURES];
+    bool matched = false;
+    bool anywhere = !whole && !(*compiled).anchored;
+    size_t position = start;
+    int i;
+    for(i = 0; i < slots; ++i){
+        empty[i] = -1;
+    }
+    if(anywhere && (*compiled).first >= 0){
+        char * next = memchr(text + position, (*compiled).first, length - position);
+        if(next == null) return false;
+        position = next - text;
+    }
+    (*compiled).generation++;
+    add_regex_thread(compiled, current, current_captures, &current_count, 0, empty, position, length);
+    for(;;){
+        (*compiled).generation++;
+        following_count = 0;
+        for(i = 0; i < current_count; ++i){
+            regex_instruction * instruction = &(*compiled).program[current[i]];
+            long * captures = current_captures + i * slots;
+            if((*instruction).kind == REGEX_MATCH){
+                if(!whole || position == length){
+                    memcpy(found, captures, sizeof(long) * slots);
+                    matched = true;
+                    /* Threads after this one have lower priority */
+                    break;
+                }
+            }
+            else if(position < length && regex_accepts(compiled, instruction, (unsigned char)text[position])){
+                add_regex_thread(compiled, following, following_captures, &following_count,
+                    current[i] + 1, captures, position + 1, length);
+            }
+        }
+        if(position >= length){
+            break;
+        }
+        position++;
+        if(anywhere && !matched){
+            if(following_count == 0 && (*compiled).first >= 0){
+                /* Nothing is running, skip to where the next match could start */
+                char * next = memchr(text + position, (*compiled).first, length - position);
+                if(next == null) break;
+                position = next - text;
+                (*compiled).generation++;
+            }
+            add_regex_thread(compiled, following, following_captures, &following_count, 0, empty, position, length);
+        }
+        if(following_count == 0 && (!anywhere || matched)){
+            /* A search keeps going, a match can still start further on, up
+               to the end of the text for patterns like $ */
+            break;
+        }
+        current_count = following_count;
+        if(current == (*compiled).threads){
+            current = following;
+            current_captures = following_captures;
+            following = (*compiled).threads;
+            following_captures = (*compiled).thread_captures;
+        }else{
+            following = current;
+            following_captures = current_captures;
+            current = (*compiled).threads;
+            current_captures = (*compiled).thread_captures;
+        }
+    }
+    return matched;
+}
+
+void add_regex_thread(regex * compiled, int * list, long * list_captures, int * count, int start, long * captures, size_t position, size_t length)
+{
+    /* Adds a thread and every thread it leads to without reading a
+       character to the end of list. It follows the choices depth first,
+       preferred ones first, with a stack of its own instead of recursion.
+       Each instruction is added once per position. */
+    int slots = 2 * (*compiled).groups;
+    int * stack = (*compiled).stack;
+    long * stack_captures = (*compiled).stack_captures;
+    int depth = 1;
+    stack[0] = start;
+    memcpy(stack_captures, captures, sizeof(long) * slots);
+    while(depth > 0){
+        regex_instruction * instruction;
+        long * saved;
+        int pc;
+        depth--;
+        pc = stack[depth];
+        saved = stack_captures + depth * slots;
+        if((*compiled).marks[pc] == (*compiled).generation){
+            continue;
+        }
+        (*compiled).marks[pc] = (*compiled).generation;
+        instruction = &(*compiled).program[pc];
+        if((*instruction).kind == REGEX_JUMP){
+            stack[depth++] = (*instruction).target;
+        }
+        else if((*instruction).kind == REGEX_SPLIT){
+            stack[depth++] = (*instruction).alternate;
+            memcpy(saved + slots, saved, sizeof(long) * slots);
+            stack[depth++] = (*instruction).target;
+        }
+        else if((*instruction).kind == REGEX_SAVE){
+            saved[(*instruction).argument] = (long)position;
+            stack[depth++] = pc + 1;
+        }
+        else if((*instruction).kind == REGEX_START){
+            if(position == 0) stack[depth++] = pc + 1;
+        }
+        else if((*instruction).kind == REGEX_END){
+            if(position == length) stack[depth++] = pc + 1;
+        }
+        else{
+            list[*count] = pc;
+            memcpy(list_captures + *count * slots, saved, sizeof(long) * slots);
+            (*count)++;
+        }
+    }
+}
+
+bool regex_accepts(regex * compiled, regex_instruction * instruction, int character)
+{
+    if((*instruction).kind == REGEX_CHAR) return character == (*instruction).argument;
+    if((*instruction).kind == REGEX_ANY) return character != '\n';
+    if((*instruction).kind == REGEX_CLASS){
+        return ((*compiled).classes[32 * (*instruction).argument + character / 8] >> (character % 8)) & 1;
+    }
+    return false;
+}
+
+void substitute_regex(char* text, regex * compiled, char* replacement)
+{
+    /* Pushes text with every match replaced. $0 to $9 in the replacement
+       stand for what the groups captured and $$ for a $. */
+    size_t length = strlen(text);
+    size_t capacity = length + 1;
+    size_t result_length = 0;
+    size_t start = 0;
+    char * result = polaris_malloc(sizeof(char) * capacity, MEMORY_STRINGS);
+    long found[2 * MAXCAPTURES];
+    while(start <= length && run_regex(compiled, text, length, start, false, found)){
+        size_t i;
+        result = append_text(result, &result_length, &capacity, text + start, (size_t)found[0] - start);
+        for(i = 0; replacement[i] != '\0'; ++i){
+            if(replacement[i] == '$' && replacement[i+1] == '$'){
+                result = append_text(result, &result_length, &capacity, "$", 1);
+                ++i;
+            }
+            else if(replacement[i] == '$' && replacement[i+1] >= '0' && replacement[i+1] <= '9'){
+                int group = replacement[i+1] - '0';
+                if(group < (*compiled).groups && found[2 * group] >= 0){
+                    result = append_text(result, &result_length, &capacity,
+                        text + found[2 * group], found[2 * group + 1] - found[2 * group]);
+                }
+                ++i;
+            }
+            else{
+                result = append_text(result, &result_length, &capacity, replacement + i, 1);
+            }
+        }
+        if(found[1] == found[0]){
+            /* An empty match, the character after it is kept and the search goes on from there */
+            if((size_t)found[0] < length){
+                result = append_text(result, &result_length, &capacity, text + found[0], 1);
+            }
+            start = found[0] + 1;
+        }else{
+            start = found[1];
+        }
+    }
+    if(start < length){
+        result = append_text(result, &result_length, &capacity, text + start, length - start);
+    }
+    stack_push(result, 0, result_length, false, true);
+    polaris_free(result);
+}
+
+char * append_text(char* destination, size_t * length, size_t * capacity, char* text, size_t text_length)
+{
+    /* Appends to a growing string, returns where the string is now */
+    if(*length + text_length + 1 > *capacity){
+        *capacity = (*length + text_length + 1) * 2;
+        destination = polaris_realloc(destination, sizeof(char) * *capacity, MEMORY_STRINGS);
+    }
+    memcpy(destination + *length, text, text_length);
+    *length += text_length;
+    destination[*length] = '\0';
+    return destination;
+}
+
+void format_template(char* template)
+{
+    /* Pushes template with its placeholders filled in. {} takes the next
+       value from the stack, deepest first, and {name} the value of a
+       variable. After a colon, a placeholder can have - to align left, 0 to
+       pad numbers with zeros, a width and .precision to show the value as a
+       number with that many decimals. {{ and }} stand for braces. */
+    stack_element ** values = null;
+    size_t value_count = 0;
+    size_t length;
+    size_t i;
+    char * result;
+    value_count = fill_template(template, null, null, true);
+    if(value_count > 0){
+        values = polaris_malloc(sizeof(stack_element *) * value_count, MEMORY_STACK);
+        for(i = value_count; i > 0; --i){
+            values[i - 1] = stack_pop();
+        }
+    }
+    /* Measured first so the result is allocated once */
+    length = fill_template(template, values, null, false);
+    result = polaris_malloc(sizeof(char) * (length + 1), MEMORY_STRINGS);
+    fill_template(template, values, result, false);
+    for(i = 0; i < value_count; ++i){
+        delete_element(values[i]);
+    }
+    polaris_free(values);
+    stack_push(result, 0, length, false, true);
+    polaris_free(result);
+}
+
+size_t fill_template(char* template, stack_element ** values, char* destination, bool counting)
+{
+    /* Writes the filled template to destination, or only measures it if
+       destination is null. Returns the length, or when counting, how many
+       values the placeholders take from the stack. */
+    size_t length = 0;
+    size_t next_value = 0;
+    size_t i = 0;
+    while(template[i] != '\0'){
+        char * value;
+        char number_s[400];
+        char name[MAXLINELENGTH + 1];
+        size_t name_length = 0;
+        size_t value_length;
+        size_t width = 0;
+        int precision = -1;
+        bool left = false;
+        bool zeros = false;
+        size_t sign = 0;
+        if(template[i] == '}' && template[i+1] == '}'){
+            put_text(destination, &length, "}", 1);
+            i += 2;
+            continue;
+        }
+        if(template[i] != '{' || template[i+1] == '{'){
+            put_text(destination, &length, template + i, 1);
+            i += template[i] == '{' ? 2 : 1;
+            continue;
+        }
+        /* Placeholder */
+        ++i;
+        while(template[i] != '}' && template[i] != ':' && template[i] != '\0'){
+            if(name_length < MAXLINELENGTH) name[name_length++] = template[i];
+            ++i;
+        }
+        name[name_length] = '\0';
+        if(template[i] == ':'){
+            ++i;
+            for(; template[i] == '-' || template[i] == '0'; ++i){
+                if(template[i] == '-') left = true;
+                else zeros = true;
+            }
+            while(template[i] >= '0' && template[i] <= '9'){
+                width = width * 10 + (template[i++] - '0');
+            }
+            if(template[i] == '.'){
+                precision = 0;
+                for(++i; template[i] >= '0' && template[i] <= '9'; ++i){
+                    if(precision < 40) precision = precision * 10 + (template[i] - '0');
+                }
+                if(precision > 40) precision = 40;
+            }
+        }
+        if(template[i] != '}'){
+            fprintf(program_output, "When filling template: %s\r\n", template);
+            error("unterminated placeholder in template.");
+        }
+        ++i;
+        if(counting){
+            if(name_length == 0) next_value++;
+            continue;
+        }
+        if(name_length == 0){
+            value = (*values[next_value++]).value;
+        }else{
+            var_element * var = find_var(name);
+            if(var == null){
+                fprintf(program_output, "When trying to get variable: %s\r\n", name);
+                error("variable not found.");
+            }
+            value = (*var).value;
+        }
+        if(precision >= 0){
+            if(!str_is_num(value, 0, strlen(value))){
+                fprintf(program_output, "When filling template: %s\r\n", template);
+                error("trying to format a non-numeric value as a number.");
+            }
+            if(is_integer_text(value) && strlen(value) <= BIGLIMBS * 4 + 1){
+                /* Whole numbers keep every digit, which atof would round */
+                size_t end;
+                normalize_integer(number_s, value);
+                end = strlen(number_s);
+                if(precision > 0){
+                    number_s[end++] = '.';
+                    memset(number_s + end, '0', (size_t)precision);
+                    number_s[end + precision] = '\0';
+                }
+            }else{
+                sprintf(number_s, "%.*f", precision, atof(value));
+            }
+            value = number_s;
+        }
+        value_length = strlen(value);
+        if(zeros && !left && (value[0] == '-' || value[0] == '+')){
+            /* Zeros go after the sign */
+            put_text(destination, &length, value, 1);
+            sign = 1;
+        }
+        if(!left){
+            for(; width > value_length; --width){
+                put_text(destination, &length, zeros ? "0" : " ", 1);
+            }
+        }
+        put_text(destination, &length, value + sign, value_length - sign);
+        for(; width > value_length; --width){
+            put_text(destination, &length, " ", 1);
+        }
+    }
+    return counting ? next_value : length;
+}
+
+void put_text(char* destination, size_t * length, char* text, size_t text_length)
+{
+    if(destination != null){
+        memcpy(destination + *length, text, text_length);
+    }
+    *length += text_length;
+}
+
+void resolve_import(char* new_path, char* base_path, char* route){
+    /* Works out the path of a file imported from base_path */
+    if(strlen(route) == 0){
+        error("Invalid route for import (empty string).");
+    }
+    #if OS_TYPE == 1
+        if(route[0] == '/'){
+            /*Absolute Paths*/
+            strcpy(new_path, route);
+        }else{
+            /* Relative Paths */
+            strcpy(new_path, base_path);
+            strcat(new_path, "/");
+            strcat(new_path, route);
+        }
+    #elif OS_TYPE == 2 || OS_TYPE == 3
+        if(strlen(route) > 1 && route[1] == ':'){
+            /*Absolute Paths*/
+            strcpy(new_path, route);
+        }else{
+            /* Relative Paths */
+            strcpy(new_path, base_path);
+            strcat(new_path, "/");
+            strcat(new_path, route);
+        }
+    #endif
+}
+
+void remove_file_name(char* path){
+    /* Leaves only the directory of a file path, the base path of an import */
+    int i;
+    for(i = strlen(path) - 1; i > 0; i--){
+        if(path[i] == '/' || path[i] == '\\'){
+            path[i] = '\0';
+            break;
+        }
+    }
+}
+
+void map_list(char* list, char* delimiter, char* block, char* base_path){
+    /* Evaluates block once for every element of list. Each element is
+       evaluated on a private stack that holds only that element, so a block
+       can neither see nor disturb the caller's values. The value left on top
+       of each private stack is joined into the result using the same
+       delimiter, in the order of the elements. A delimiter at the start or
+       the end of the list has an empty element on its other side. An empty
+       delimiter maps over single characters. On Unix, blocks that use
+       nothing but their own stack have their elements evaluated on a
+       thread for each processor, any other block runs on one element after
+       another. */
+    stack_element * saved_stack = stack;
+    size_t list_length = strlen(list);
+    size_t delimiter_length = strlen(delimiter);
+    size_t result_capacity = list_length + 1;
+    size_t result_length = 0;
+    char * result;
+    size_t element_start = 0;
+    size_t element_end;
+    bool more = list_length > 0;
+    code_block * code = compile_block(block);
+    (*code).references++;
+    #if OS_TYPE == 1
+        if(!show_pushpops && !profiling && block_is_private(code) && map_in_parallel(list, delimiter, code)){
+            release_block(code);
+            return;
+        }
+    #endif
+    result = polaris_malloc(sizeof(char) * result_capacity, MEMORY_STRINGS);
+    result[0] = '\0';
+    while(more){
+        stack_element * element_result;
+        size_t value_length;
+        /* Find the end of the current element */
+        if(delimiter_length == 0){
+            element_end = element_start + 1;
+            more = element_end < list_length;
+        }else{
+            char * found = strstr(list + element_start, delimiter);
+            element_end = found == null ? list_length : (size_t)(found - list);
+            more = found != null;
+        }
+        /* Evaluate the block on a private stack */
+        stack = null;
+        stack_push(list, element_start, element_end, false, true);
+        eval_block(code, base_path);
+        if(stack == null){
+            error("map block left no value on the stack.");
+        }
+        element_result = stack_pop();
+        while(stack != null){
+            delete_element(stack_pop());
+        }
+        stack = saved_stack;
+        /* Append the value to the result */
+        value_length = strlen((*element_result).value);
+        if(result_length + value_length + delimiter_length + 1 > result_capacity){
+            result_capacity = (result_length + value_length + delimiter_length + 1) * 2;
+            result = polaris_realloc(result, sizeof(char) * result_capacity, MEMORY_STRINGS);
+        }
+        if(element_start > 0){
+            strcpy(result + result_length, delimiter);
+            result_length += delimiter_length;
+        }
+        strcpy(result + result_length, (*element_result).value);
+        result_length += value_length;
+        delete_element(element_result);
+        element_start = element_end + delimiter_length;
+    }
+    release_block(code);
+    stack_push(result, 0, result_length, false, true);
+    polaris_free(result);
+}
+
+#if OS_TYPE == 1
+bool map_in_parallel(char* list, char* delimiter, code_block * code){
+    /* Evaluates a private block for every element of list on the map
+       workers and pushes the results joined in the order of the elements.
+       Each worker takes the next element nobody has taken yet, so a slow
+       element doesn't hold back the rest. Returns false if the map has to
+       run in order instead: with a single processor or element, or when an
+       element failed, so that it fails again where its error is reported. */
+    map_job job;
+    size_t list_length = strlen(list);
+    size_t delimiter_length = strlen(delimiter);
+    size_t result_length = 0;
+    size_t position = 0;
+    size_t i;
+    char * result;
+    char * found;
+    if(map_worker_count == 0){
+        start_map_workers();
+    }
+    if(map_worker_count < 2 || list_length == 0){
+        return false;
+    }
+    /* Split the list the same way map_list walks it */
+    job.count = delimiter_length == 0 ? list_length : 1;
+    if(delimiter_length > 0){
+        for(found = strstr(list, delimiter); found != null; found = strstr(found + delimiter_length, delimiter)){
+            job.count++;
+        }
+    }
+    if(job.count < 2){
+        return false;
+    }
+    job.code = code;
+    job.list = list;
+    job.starts = polaris_malloc(sizeof(size_t) * job.count, MEMORY_OTHER);
+    job.ends = polaris_malloc(sizeof(size_t) * job.count, MEMORY_OTHER);
+    job.results = polaris_malloc(sizeof(char *) * job.count, MEMORY_OTHER);
+    job.next = 0;
+    job.failed = false;
+    for(i = 0; i < job.count; ++i){
+        job.starts[i] = position;
+        if(delimiter_length == 0){
+            job.ends[i] = position + 1;
+        }else{
+            found = strstr(list + position, delimiter);
+            job.ends[i] = found == null ? list_length : (size_t)(found - list);
+        }
+        job.results[i] = null;
+        position = job.ends[i] + delimiter_length;
+    }
+    /* The helpers and this thread evaluate elements until none are left */
+    pthread_mutex_lock(&map_lock);
+    current_map = &job;
+    map_running = true;
+    map_busy_workers = map_worker_count - 1;
+    map_round++;
+    pthread_cond_broadcast(&map_work_ready);
+    pthread_mutex_unlock(&map_lock);
+    run_map_elements(&job, &map_workers[0]);
+    pthread_mutex_lock(&map_lock);
+    while(map_busy_workers > 0){
+        pthread_cond_wait(&map_work_done, &map_lock);
+    }
+    map_running = false;
+    current_map = null;
+    pthread_mutex_unlock(&map_lock);
+    add_map_memory();
+    if(!job.failed){
+        for(i = 0; i < job.count; ++i){
+            result_length += strlen(job.results[i]) + (i > 0 ? delimiter_length : 0);
+        }
+        result = polaris_malloc(sizeof(char) * (result_length + 1), MEMORY_STRINGS);
+        result_length = 0;
+        for(i = 0; i < job.count; ++i){
+            if(i > 0){
+                strcpy(result + result_length, delimiter);
+                result_length += delimiter_length;
+            }
+            strcpy(result + result_length, job.results[i]);
+            result_length += strlen(job.results[i]);
+        }
+        stack_push(result, 0, result_length, false, true);
+        polaris_free(result);
+    }
+    for(i = 0; i < job.count; ++i){
+        if(job.results[i] != null) polaris_free(job.results[i]);
+    }
+    polaris_free(job.starts);
+    polaris_free(job.ends);
+    polaris_free(job.results);
+    return !job.failed;
+}
+
+void start_map_workers()
+{
+    /* Starts a helper thread for every processor but the one the program
+       runs on. The helpers wait for maps until the program ends. */
+    long processors = 1;
+    int i;
+    #ifdef _SC_NPROCESSORS_ONLN
+        processors = sysconf(_SC_NPROCESSORS_ONLN);
+    #endif
+    if(processors > MAXMAPWORKERS) processors = MAXMAPWORKERS;
+    map_worker_count = 1;
+    if(pthread_key_create(&map_worker_key, null) != 0){
+        return;
+    }
+    map_workers[0].thread = pthread_self();
+    pthread_setspecific(map_worker_key, &map_workers[0]);
+    for(i = 1; i < processors; ++i){
+        if(pthread_create(&map_workers[i].thread, null, map_helper, &map_workers[i]) != 0){
+            break;
+        }
+        map_worker_count++;
+    }
+}
+
+void * map_helper(void * argument)
+{
+    /* Body of a helper thread: takes part in every map handed out */
+    map_worker * worker = argument;
+    unsigned long seen = 0;
+    pthread_setspecific(map_worker_key, worker);
+    while(true){
+        map_job * job;
+        pthread_mutex_lock(&map_lock);
+        while(map_round == seen){
+            pthread_cond_wait(&map_work_ready, &map_lock);
+        }
+        seen = map_round;
+        job = current_map;
+        pthread_mutex_unlock(&map_lock);
+        run_map_elements(job, worker);
+        pthread_mutex_lock(&map_lock);
+        if(--map_busy_workers == 0){
+            pthread_cond_signal(&map_work_done);
+        }
+        pthread_mutex_unlock(&map_lock);
+    }
+    return null;
+}
+
+void run_map_elements(map_job * job, map_worker * worker)
+{
+    /* Evaluates elements of a map on the private stack of a worker until
+       there are none left or one of them fails */
+    size_t element;
+    if(setjmp((*worker).failure) != 0){
+        /* error() was called while evaluating an element */
+        pthread_mutex_lock(&map_lock);
+        (*job).failed = true;
+        pthread_mutex_unlock(&map_lock);
+    }
+    while(true){
+        pthread_mutex_lock(&map_lock);
+        if((*job).failed || (*job).next == (*job).count){
+            pthread_mutex_unlock(&map_lock);
+            break;
+        }
+        element = (*job).next++;
+        pthread_mutex_unlock(&map_lock);
+        private_push_text(worker, (*job).list + (*job).starts[element], (*job).ends[element] - (*job).starts[element]);
+        run_private_block((*job).code, worker);
+        if((*worker).value_count == 0){
+            error("map block left no value on the stack.");
+        }
+        (*job).results[element] = (*worker).values[--(*worker).value_count];
+        private_drop(worker, (*worker).value_count);
+    }
+    private_drop(worker, (*worker).value_count);
+    polaris_free((*worker).values);
+    (*worker).values = null;
+    (*worker).value_capacity = 0;
+}
+
+void add_map_memory()
+{
+    /* Adds the memory the workers counted during a map to the totals. As
+       their peaks could have come at the same time, they are added up. */
+    int category;
+    int i;
+    for(category = 0; category < MEMORY_CATEGORIES; ++category){
+        unsigned long peak = memory_in_use[category];
+        for(i = 0; i < map_worker_count; ++i){
+            map_worker * worker = &map_workers[i];
+            peak += (*worker).memory_peak[category];
+            memory_in_use[category] += (*worker).memory_in_use[category];
+            memory_blocks[category] += (*worker).memory_blocks[category];
+            memory_allocations[category] += (*worker).memory_allocations[category];
+            (*worker).memory_in_use[category] = 0;
+            (*worker).memory_peak[category] = 0;
+            (*worker).memory_blocks[category] = 0;
+            (*worker).memory_allocations[category] = 0;
+        }
+        if(peak > memory_peak[category]){
+            memory_peak[category] = peak;
+        }
+    }
+}
+
+bool block_is_private(code_block * code)
+{
+    /* Whether a block uses nothing but its own stack: it reads and writes
+       no variables and it doesn't print, evaluate code built while running,
+       or use tasks, files or connections. Such a block can be evaluated for
+       many elements at the same time without them seeing each other. */
+    size_t i;
+    for(i = 0; i < (*code).token_count; ++i){
+        token * current = &(*code).tokens[i];
+        int word = (*current).word;
+        if((*current).kind == TOKEN_PUSH){
+            continue;
+        }
+        if((*current).kind == TOKEN_IF){
+            if(!block_is_private((*current).blocks[0]) || !block_is_private((*current).blocks[1])
+                || !block_is_private((*current).blocks[2])){
+                return false;
+            }
+        }
+        else if((*current).kind == TOKEN_WHILE){
+            if(!block_is_private((*current).blocks[0]) || !block_is_private((*current).blocks[1])){
+                return false;
+            }
+        }
+        else if(
+            (*current).kind != TOKEN_WORD
+            || !(is_arithmetic(word) || is_comparison(word) || (word >= WORD_SIN && word <= WORD_LOG)
+                || word == WORD_NOT || word == WORD_AND || word == WORD_OR || word == WORD_JOIN
+                || word == WORD_COPY || word == WORD_DEL || word == WORD_SWAP)
+        ){
+            return false;
+        }
+    }
+    return true;
+}
+
+void run_private_block(code_block * code, map_worker * worker)
+{
+    /* Evaluates a private block on the stack of a worker */
+    size_t i;
+    for(i = 0; i < (*code).token_count; ++i){
+        token * current = &(*code).tokens[i];
+        if((*current).kind == TOKEN_PUSH){
+            private_push_text(worker, (*current).text, strlen((*current).text));
+        }
+        else if((*current).kind == TOKEN_WORD){
+            run_private_word((*current).word, worker);
+        }
+        else if((*current).kind == TOKEN_IF){
+            bool truth;
+            run_private_block((*current).blocks[0], worker);
+            truth = strcmp(private_top(worker, 1)[0], "0") != 0;
+            private_drop(worker, 1);
+            run_private_block((*current).blocks[truth ? 1 : 2], worker);
+        }
+        else{
+            while(true){
+                bool truth;
+                run_private_block((*current).blocks[0], worker);
+                truth = strcmp(private_top(worker, 1)[0], "0") != 0;
+                private_drop(worker, 1);
+                if(!truth) break;
+                run_private_block((*current).blocks[1], worker);
+            }
+        }
+    }
+}
+
+void run_private_word(int word, map_worker * worker)
+{
+    /* Evaluates a word a private block can have, like eval_reserved_word */
+    char result_s[NUMBERLENGTH];
+    char ** values;
+    if(is_arithmetic(word) || is_comparison(word)){
+        values = private_top(worker, 2);
+        operate(word, values[0], values[1], result_s);
+        private_drop(worker, 2);
+        private_push_text(worker, result_s, strlen(result_s));
+    }
+    else if(word >= WORD_SIN && word <= WORD_LOG){
+        values = private_top(worker, 1);
+        operate_function(word, values[0], result_s);
+        private_drop(worker, 1);
+        private_push_text(worker, result_s, strlen(result_s));
     }
-    /* join */
-    else if(comp_substr(source, token_start, token_end, "join")){
-        stack_element * value2 = stack_pop();
-        stack_element * value1 = stack_pop();
-        size_t new_length = strlen((*value1).value) + strlen((*value2).value) + 1;
-        char * new_value = malloc(sizeof(char) * new_length);
-        strcpy(new_value, (*value1).value);
-        strcat(new_value, (*value2).value);
-        stack_push(new_value, 0, strlen(new_value), false, true);
-        free(new_value);
-        delete_element(value2);
-        delete_element(value1);
+    else if(word == WORD_NOT){
+        bool truth = strcmp(private_top(worker, 1)[0], "0") == 0;
+        private_drop(worker, 1);
+        private_push_text(worker, truth ? "1" : "0", 1);
     }
-    /* copy */
-    else if(comp_substr(source, token_start, token_end, "copy")){
-        stack_element * value = stack_pop();
-        stack_push((*value).value, 0, strlen((*value).value), false, true);
-        stack_push((*value).value, 0, strlen((*value).value), false, true);
-        delete_element(value);
+    else if(word == WORD_AND || word == WORD_OR){
+        bool truth;
+        values = private_top(worker, 2);
+        if(word == WORD_AND) truth = strcmp(values[0], "0") != 0 && strcmp(values[1], "0") != 0;
+        else truth = strcmp(values[0], "0") != 0 || strcmp(values[1], "0") != 0;
+        private_drop(worker, 2);
+        private_push_text(worker, truth ? "1" : "0", 1);
     }
-    /* del */
-    else if(comp_substr(source, token_start, token_end, "del")){
-        stack_element * value = stack_pop();
-        delete_element(value);
+    else if(word == WORD_JOIN){
+        char * joined;
+        values = private_top(worker, 2);
+        joined = polaris_malloc(sizeof(char) * (strlen(values[0]) + strlen(values[1]) + 1), MEMORY_STACK);
+        strcpy(joined, values[0]);
+        strcat(joined, values[1]);
+        private_drop(worker, 2);
+        private_push(worker, joined);
     }
-    /* swap */
-    else if(comp_substr(source, token_start, token_end, "swap")){
-        stack_element * value2 = stack_pop();
-        stack_element * value1 = stack_pop();
-        stack_push((*value2).value, 0, strlen((*value2).value), false, true);
-        stack_push((*value1).value, 0, strlen((*value1).value), false, true);
-        delete_element(value1);
-        delete_element(value2);
+    else if(word == WORD_COPY){
+        values = private_top(worker, 1);
+        private_push_text(worker, values[0], strlen(values[0]));
     }
-    /* input */
-    else if(comp_substr(source, token_start, token_end, "input")){
-        char * input = malloc(sizeof(char) * (MAXINPUTLENGTH + 1));
-        fgets(input, MAXINPUTLENGTH, stdin);
-        stack_push(input, 0, strlen(input), false, true);
-        free(input);
+    else if(word == WORD_DEL){
+        private_top(worker, 1);
+        private_drop(worker, 1);
     }
-    /* >var */
-    else if(comp_substr(source, token_start, token_start + 1, ">")){
-        stack_element * value = stack_pop();
-        char * var_name = malloc((token_end - token_start) * sizeof(char));
-        copy_substr(var_name, source, token_start+1, token_end);
-        set_var_value(var_name, (*value).value);
-        free(var_name);
-        delete_element(value);
+    else{
+        char * swapped;
+        values = private_top(worker, 2);
+        swapped = values[0];
+        values[0] = values[1];
+        values[1] = swapped;
     }
-    /* @var */
-    else if(comp_substr(source, token_start, token_start + 1, "@")){
-        char * var_name = malloc((token_end - token_start) * sizeof(char));
-        copy_substr(var_name, source, token_start+1, token_end);
-        get_var_value(var_name);
-        free(var_name);
+}
+
+char ** private_top(map_worker * worker, size_t count)
+{
+    /* Returns the top count values of a worker's stack, deepest first */
+    if((*worker).value_count < count){
+        error("cannot pop from an empty stack.");
     }
-    /* % */
-    else if(comp_substr(source, token_end-1, token_end, "%")){
-        stack_element * value;
-        char * var_name = malloc((token_end - token_start) * sizeof(char));
-        copy_substr(var_name, source, token_start, token_end-1);
-        get_var_value(var_name);
-        free(var_name);
-        value = stack_pop();
-        eval((*value).value, base_path);
-        delete_element(value);
+    return (*worker).values + (*worker).value_count - count;
+}
+
+void private_drop(map_worker * worker, size_t count)
+{
+    while(count-- > 0){
+        polaris_free((*worker).values[--(*worker).value_count]);
     }
-    /* random */
-    else if(comp_substr(source, token_start, token_end, "random")){
-        char result_s[50];
-        num_to_str(result_s, ((double) rand() / (RAND_MAX)));
-        stack_push(result_s, 0, 50, true, false);
+}
+
+void private_push(map_worker * worker, char* value)
+{
+    /* Pushes a value allocated with MEMORY_STACK, which now belongs to the worker */
+    if((*worker).value_count == (*worker).value_capacity){
+        (*worker).value_capacity = (*worker).value_capacity * 2 + 16;
+        (*worker).values = polaris_realloc((*worker).values, sizeof(char *) * (*worker).value_capacity, MEMORY_STACK);
     }
-    /* exit */
-    else if(comp_substr(source, token_start, token_end, "exit")){
-        return 1;
+    (*worker).values[(*worker).value_count++] = value;
+}
+
+void private_push_text(map_worker * worker, char* text, size_t length)
+{
+    /* Pushes a copy of text, the way stack_push copies it */
+    char * value = polaris_malloc(sizeof(char) * (length + 1), MEMORY_STACK);
+    copy_substr(value, text, 0, length);
+    private_push(worker, value);
+}
+#endif
+
+void translate(char* source, char* path){
+    /* Writes to stdout a C program that runs source. The program includes
+       this file as its runtime and compiles the same blocks when it starts,
+       so translated code can refer to their tokens by position. if and
+       while with literal blocks, eval of literal blocks and import of
+       literal paths become plain C, calls to functions whose body is known
+       call its translation and every other word is evaluated as usual. */
+    int slot;
+    int i;
+    bool promoted = true;
+    add_translated_block(translated_block(source), -1, 0, -1, source, ".", true);
+    scan_translated_block(0);
+    /* Translate the functions that are called, which may call others */
+    while(promoted){
+        promoted = false;
+        for(i = 0; i < translated_function_count; ++i){
+            translated_function * function = &translated_functions[i];
+            if((*function).called && !(*function).ambiguous && (*function).body != null && (*function).slot < 0){
+                (*function).slot = add_translated_block(translated_block((*function).body),
+                    (*function).parent, (*function).token_index, -1, null, null, true);
+                scan_translated_block((*function).slot);
+                promoted = true;
+            }
+        }
     }
-    /* import */
-    else if(comp_substr(source, token_start, token_end, "import")){
-        int i = 0;
-        stack_element * value = stack_pop();
-        char new_path[512];
-        char * file_contents;
-        if(strlen((*value).value) == 0){
-            error("Invalid route for import (empty string).");
+    printf("/* Translated from %s by Polaris %s */\n", path, VERSION);
+    printf("#define POLARIS_RUNTIME\n#include \"polaris.c\"\n\n");
+    printf("#define T(block, index) (&(*blocks[block]).tokens[index])\n");
+    printf("code_block * blocks[%d];\n", translation_count);
+    for(slot = 0; slot < translation_count; ++slot){
+        if(translations[slot].source != null){
+            char * source = translations[slot].source;
+            size_t length = strlen(source);
+            size_t from;
+            /* Split into short literals, long ones aren't portable */
+            printf("char * source_%d[] = {\n", slot);
+            for(from = 0; from < length; from += 64){
+                char piece[65];
+                strncpy(piece, source + from, 64);
+                piece[64] = '\0';
+                printf("    ");
+                emit_translated_string(piece);
+                printf(",\n");
+            }
+            printf("    null\n};\n");
         }
-        #if OS_TYPE == 1
-            if((*value).value[0] == '/'){
-                /*Absolute Paths*/
-                strcpy(new_path, (*value).value);
-                strcat(new_path, "\0");
-            }else{
-                /* Relative Paths */
-                strcpy(new_path, base_path);
-                strcat(new_path, "/");
-                strcat(new_path, (*value).value);
-            }
-        #elif OS_TYPE == 2 || OS_TYPE == 3
-            if(strlen((*value).value) > 1 && (*value).value[1] == ':'){
-                /*Absolute Paths*/
-                strcpy(new_path, (*value).value);
-                strcat(new_path, "\0");
-            }else{
-                /* Relative Paths */
-                strcpy(new_path, base_path);
-                strcat(new_path, "/");
-                strcat(new_path, (*value).value);
+    }
+    for(slot = 0; slot < translation_count; ++slot){
+        if(translations[slot].function){
+            printf("void block_%d(char* base_path);\n", slot);
+        }
+    }
+    printf("\nvoid setup_blocks()\n{\n");
+    for(slot = 0; slot < translation_count; ++slot){
+        translation * block = &translations[slot];
+        if((*block).source != null){
+            printf("    blocks[%d] = translated_source(source_%d);\n", slot, slot);
+        }else if((*block).nested >= 0){
+            printf("    blocks[%d] = (*T(%d, %lu)).blocks[%d];\n", slot, (*block).parent, (unsigned long)(*block).token_index, (*block).nested);
+        }else{
+            printf("    blocks[%d] = translated_block((*T(%d, %lu)).text);\n", slot, (*block).parent, (unsigned long)(*block).token_index);
+        }
+    }
+    printf("}\n");
+    for(slot = 0; slot < translation_count; ++slot){
+        if(translations[slot].function){
+            printf("\nvoid block_%d(char* base_path)\n{\n", slot);
+            printf("    check_stack(blocks[%d]);\n", slot);
+            emit_translated_block(slot, 1, 0);
+            printf("}\n");
+        }
+    }
+    printf("\nint main()\n{\n");
+    printf("    polaris_setup();\n");
+    printf("    setup_blocks();\n");
+    printf("    start_translated();\n");
+    printf("    block_0(\".\");\n");
+    printf("    finish_translated();\n");
+    printf("    return 0;\n}\n");
+}
+
+int add_translated_block(code_block * code, int parent, size_t token_index, int nested, char* source, char* base_path, bool function){
+    translation * block;
+    translations = polaris_realloc(translations, sizeof(translation) * (translation_count + 1), MEMORY_CODE);
+    block = &translations[translation_count];
+    (*block).code = code;
+    (*block).parent = parent;
+    (*block).token_index = token_index;
+    (*block).nested = nested;
+    (*block).source = source;
+    (*block).base_path = base_path;
+    (*block).function = function;
+    return translation_count++;
+}
+
+void scan_translated_block(int slot){
+    /* Finds the blocks, imports and functions a block will need translated */
+    code_block * code = translations[slot].code;
+    char * base_path = translations[slot].base_path;
+    size_t i;
+    for(i = 0; i < (*code).token_count; ++i){
+        token * current = &(*code).tokens[i];
+        token * following = i + 1 < (*code).token_count ? &(*code).tokens[i + 1] : null;
+        if((*current).kind == TOKEN_IF || (*current).kind == TOKEN_WHILE){
+            int nested;
+            for(nested = 0; nested < 3 && (*current).blocks[nested] != null; ++nested){
+                scan_translated_block(add_translated_block((*current).blocks[nested], slot, i, nested, null, base_path, false));
             }
-        #endif
-        file_contents = load_source_file(new_path);
-        for(i = strlen(new_path) - 1; i > 0; i--){
-            if(new_path[i] == '/' || new_path[i] == '\\'){
-                new_path[i] = '\0';
-                break;
+        }
+        else if((*current).kind == TOKEN_PUSH && following != null && (*following).kind == TOKEN_WORD){
+            if((*following).word == WORD_EVAL){
+                scan_translated_block(add_translated_block(translated_block((*current).text), slot, i, -1, null, base_path, false));
+            }
+            else if((*following).word == WORD_IMPORT && base_path != null){
+                char new_path[512];
+                char * file_contents;
+                resolve_import(new_path, base_path, (*current).text);
+                file_contents = load_source_file(new_path);
+                remove_file_name(new_path);
+                scan_translated_block(add_translated_block(translated_block(file_contents), slot, i, -1, file_contents, copy_string(new_path), true));
+            }
+            else if((*following).word == WORD_SET_VAR){
+                int function = find_translated_function((*following).text);
+                translated_function * assigned = &translated_functions[function];
+                if((*assigned).body == null){
+                    (*assigned).body = (*current).text;
+                    (*assigned).parent = slot;
+                    (*assigned).token_index = i;
+                }else if(strcmp((*assigned).body, (*current).text) != 0){
+                    (*assigned).ambiguous = true;
+                }
             }
         }
-        eval(file_contents, new_path);
-        if(file_contents != null) free(file_contents);
-        delete_element(value);
+        else if((*current).kind == TOKEN_WORD && (*current).word == WORD_CALL){
+            translated_functions[find_translated_function((*current).text)].called = true;
+        }
     }
-    /* sleep */
-    else if(comp_substr(source, token_start, token_end, "sleep")){
-        stack_element * value1 = stack_pop();
+}
+
+int find_translated_function(char* name){
+    /* Finds what is known about a variable called as a function, adding it if it's new */
+    translated_function * function;
+    int i;
+    for(i = 0; i < translated_function_count; ++i){
+        if(strcmp(translated_functions[i].name, name) == 0){
+            return i;
+        }
+    }
+    translated_functions = polaris_realloc(translated_functions, sizeof(translated_function) * (translated_function_count + 1), MEMORY_CODE);
+    function = &translated_functions[translated_function_count];
+    (*function).name = name;
+    (*function).body = null;
+    (*function).parent = -1;
+    (*function).token_index = 0;
+    (*function).slot = -1;
+    (*function).called = false;
+    (*function).ambiguous = false;
+    return translated_function_count++;
+}
+
+int find_translation(int parent, size_t token_index, int nested){
+    int slot;
+    for(slot = 0; slot < translation_count; ++slot){
         if(
-            !str_is_num((*value1).value, 0, strlen((*value1).value))
+            translations[slot].parent == parent && translations[slot].token_index == token_index
+            && translations[slot].nested == nested
         ){
-            error("trying to sleep a non-numerical amount of time.");
+            return slot;
         }
-        polaris_delay(atof((*value1).value));
-        delete_element(value1);
     }
-    /* Number */
-    else if(str_is_num(source, token_start, token_end)){
-        char result_s[50];
-        copy_substr(result_s, source, token_start, token_end);
-        num_to_str(result_s, atof(result_s));
-        stack_push(result_s, 0, 50, true, false);
+    return -1;
+}
+
+bool emit_translated_block(int slot, int indent, int end_label){
+    /* Writes the C code of a block. exit leaves the block by returning from
+       its function or jumping to end_label. Returns whether it jumped. */
+    code_block * code = translations[slot].code;
+    bool jumped = false;
+    size_t i;
+    for(i = 0; i < (*code).token_count; ++i){
+        token * current = &(*code).tokens[i];
+        token * following = i + 1 < (*code).token_count ? &(*code).tokens[i + 1] : null;
+        int inner = -1;
+        if((*current).kind == TOKEN_PUSH && following != null && (*following).kind == TOKEN_WORD
+            && ((*following).word == WORD_EVAL || (*following).word == WORD_IMPORT)){
+            inner = find_translation(slot, i, -1);
+        }
+        if(inner >= 0 && translations[inner].function){
+            /* import */
+            emit_indent(indent);
+            printf("block_%d(", inner);
+            emit_translated_string(translations[inner].base_path);
+            printf(");\n");
+            ++i;
+        }
+        else if(inner >= 0){
+            /* eval */
+            emit_translated_inline(inner, indent);
+            ++i;
+        }
+        else if((*current).kind == TOKEN_PUSH){
+            emit_indent(indent);
+            printf("translated_push(T(%d, %lu));\n", slot, (unsigned long)i);
+        }
+        else if((*current).kind == TOKEN_FUSED){
+            emit_indent(indent);
+            printf("apply_fused(T(%d, %lu));\n", slot, (unsigned long)i);
+        }
+        else if((*current).kind == TOKEN_IF){
+            emit_translated_inline(find_translation(slot, i, 0), indent);
+            emit_indent(indent);
+            printf("if(translated_truth()){\n");
+            emit_translated_inline(find_translation(slot, i, 1), indent + 1);
+            emit_indent(indent);
+            printf("}else{\n");
+            emit_translated_inline(find_translation(slot, i, 2), indent + 1);
+            emit_indent(indent);
+            printf("}\n");
+        }
+        else if((*current).kind == TOKEN_WHILE){
+            emit_indent(indent);
+            printf("for(;;){\n");
+            emit_translated_inline(find_translation(slot, i, 0), indent + 1);
+            emit_indent(indent + 1);
+            printf("if(!translated_truth()) break;\n");
+            emit_translated_inline(find_translation(slot, i, 1), indent + 1);
+            emit_indent(indent);
+            printf("}\n");
+        }
+        else if((*current).word == WORD_EXIT){
+            emit_indent(indent);
+            if(end_label == 0){
+                printf("return;\n");
+            }else{
+                printf("goto end_%d;\n", end_label);
+                jumped = true;
+            }
+        }
+        else if((*current).word == WORD_CALL){
+            int function = find_translated_function((*current).text);
+            int body = translated_functions[function].slot;
+            emit_indent(indent);
+            if(body >= 0 && !translated_functions[function].ambiguous){
+                printf("translated_call(T(%d, %lu), blocks[%d], block_%d, base_path);\n", slot, (unsigned long)i, body, body);
+            }else{
+                printf("translated_word(T(%d, %lu), base_path);\n", slot, (unsigned long)i);
+            }
+        }
+        else{
+            emit_indent(indent);
+            printf("translated_word(T(%d, %lu), base_path);\n", slot, (unsigned long)i);
+        }
     }
-    /* Plain strings */
-    else{
-        stack_push(source, token_start, token_end, true, false);
+    return jumped;
+}
+
+void emit_translated_inline(int slot, int indent){
+    /* Writes a block in place, with a label for exit to jump to */
+    int end_label = ++translated_label_count;
+    if(emit_translated_block(slot, indent, end_label)){
+        emit_indent(indent);
+        printf("end_%d: ;\n", end_label);
     }
-    return 0;
 }
 
-void set_var_value(char* var, char* value){
-    var_element * current_var;
-    size_t string_length;
-    current_var = variables;
-    while(current_var != null){
-        if(strcmp((*current_var).name, var) == 0){
-            break;
+void emit_translated_string(char* value){
+    /* Writes a C string literal */
+    putchar('"');
+    while(*value != '\0'){
+        if(*value == '\\' || *value == '"'){
+            printf("\\%c", *value);
+        }else if(*value >= 32 && *value <= 126){
+            putchar(*value);
+        }else{
+            printf("\\%03o", (unsigned char)*value);
         }
-        else current_var = (*current_var).next;
+        value++;
     }
-    if(current_var == null){
-        size_t name_length;
-        current_var = malloc(sizeof(var_element));
-        name_length = strlen(var)+1;
-        (*current_var).next = variables;
-        (*current_var).name = malloc(sizeof(char) * name_length);
-        strcpy((*current_var).name, var);
-        variables = current_var;
-    }else{
-        free((*current_var).value);
+    putchar('"');
+}
+
+void emit_indent(int indent){
+    int i;
+    for(i = 0; i < indent; ++i){
+        printf("    ");
     }
-    string_length = strlen(value)+1;
-    (*current_var).value = malloc(sizeof(char) * string_length);
-    strcpy((*current_var).value, value);
 }
 
-void get_var_value(char* var){
-    var_element * current_var = variables;
-    while(current_var != null){
-        if(strcmp((*current_var).name, var) == 0){
-            stack_push((*current_var).value, 0, strlen((*current_var).value), true, true);
+code_block * translated_block(char* source){
+    /* Compiles a block for translated code and keeps it */
+    code_block * code = compile_block(source);
+    (*code).references++;
+    return code;
+}
+
+code_block * translated_source(char** lines){
+    /* Joins the pieces of a translated source and compiles it */
+    size_t length = 0;
+    char * source;
+    code_block * code;
+    int i;
+    for(i = 0; lines[i] != null; ++i){
+        length += strlen(lines[i]);
+    }
+    source = polaris_malloc(sizeof(char) * (length + 1), MEMORY_STRINGS);
+    source[0] = '\0';
+    for(i = 0; lines[i] != null; ++i){
+        strcat(source, lines[i]);
+    }
+    code = translated_block(source);
+    polaris_free(source);
+    return code;
+}
+
+void start_translated(){
+    /* Makes translated code the main task */
+    main_task = polaris_malloc(sizeof(task), MEMORY_OTHER);
+    main_stack = null;
+    main_running = true;
+    (*main_task).frames = null;
+    (*main_task).stack = null;
+    (*main_task).sleeping = false;
+    (*main_task).native = true;
+    (*main_task).next = tasks;
+    tasks = main_task;
+    current_task = main_task;
+}
+
+void finish_translated(){
+    /* Runs whatever translated code left running once it has finished */
+    task * previous = null;
+    task * current = tasks;
+    while(current != main_task){
+        previous = current;
+        current = (*current).next;
+    }
+    if(previous == null) tasks = (*current).next;
+    else (*previous).next = (*current).next;
+    polaris_free(current);
+    main_task = null;
+    main_running = false;
+    current_task = null;
+    frames = null;
+    if(tasks != null || timers != null || listener_count > 0){
+        run_tasks();
+    }
+}
+
+void translated_push(token * value){
+    stack_push((*value).text, 0, strlen((*value).text), false, true);
+}
+
+void translated_word(token * word, char* base_path){
+    /* Evaluates a word for translated code. A word that has to wait lets
+       the other tasks run until it can go on, and frames pushed by words
+       like eval or name% are run before returning. */
+    frame * caller = frames;
+    while(eval_reserved_word((*word).word, word, base_path) == 2){
+        translated_wait(true);
+    }
+    for(;;){
+        int result;
+        if((*current_task).sleeping){
+            translated_wait(true);
+            continue;
+        }
+        if(frames == caller){
+            break;
+        }
+        result = run_frames(caller, TASKSLICE);
+        if(result == RUN_YIELDED){
+            translated_wait(false);
+        }else if(result == RUN_WAITING && !(*current_task).sleeping){
+            translated_wait(true);
+        }
+    }
+}
+
+void translated_call(token * call, code_block * known, void (*native)(char*), char* base_path){
+    /* Calls a function with its translation if the variable still holds
+       the body it was translated from */
+    var_element * function = lookup_var((*call).text, &(*call).variable);
+    if(function != null && (*function).memo_inputs < 0){
+        if((*function).code == null){
+            (*function).code = compile_block((*function).value);
+            (*(*function).code).references++;
+        }
+        if((*function).code == known){
+            native(base_path);
             return;
         }
-        else current_var = (*current_var).next;
     }
-    printf("When trying to get variable: %s\r\n", var);
-    error("variable not found.");
+    translated_word(call, base_path);
+}
+
+bool translated_truth(){
+    /* Pops the result of a condition */
+    stack_element * result = stack_pop();
+    bool truth = strcmp((*result).value, "0") != 0;
+    delete_element(result);
+    return truth;
+}
+
+void translated_wait(bool blocked){
+    /* Lets every other task, timer and connection take a turn while
+       translated code waits, sleeping if nothing else can run */
+    task * native = current_task;
+    frame * native_frames = frames;
+    stack_element * native_stack = stack;
+    bool progressed = run_round();
+    current_task = native;
+    frames = native_frames;
+    stack = native_stack;
+    if((*native).sleeping && (long)(polaris_ticks() - (*native).wake_at) >= 0){
+        (*native).sleeping = false;
+        return;
+    }
+    if(!progressed && blocked){
+        wait_for_progress();
+    }
 }
 
 void num_to_str(char* destination, pnumber number){
     size_t number_len;
     size_t i;
     char buffer[50];
+    if(fabs(number) >= 1e21){
+        /* %f would write every digit */
+        sprintf(destination, "%.15g", number);
+        return;
+    }
     sprintf(buffer, "%f", number);
     number_len = strlen(buffer);
     for(i = number_len - 1; i > 0; --i){
@@ -1092,15 +5905,51 @@ void stack_push(char* source, size_t from, size_t to, bool trim, bool pushempty)
         }
     }
     if(from < to || pushempty){
-        stack_element * element_to_push;
-        size_t string_length = to - from;
-        element_to_push = malloc(sizeof(stack_element));
-        (*element_to_push).value = malloc(sizeof(char) * (string_length + 1));
+        stack_element * element_to_push = new_element();
+        if(to - from < INLINEVALUE){
+            /* Short values, like truth values and most numbers, need no block of their own */
+            (*element_to_push).value = (*element_to_push).inline_value;
+        }else{
+            (*element_to_push).value = polaris_malloc(sizeof(char) * (to - from + 1), MEMORY_STACK);
+        }
         copy_substr((*element_to_push).value, source, from, to);
-        (*element_to_push).next = stack;
-        stack = element_to_push;
-        if(show_pushpops) printf("Push: \"%s\"\r\n", (*stack).value);
+        push_element(element_to_push);
+    }
+}
+
+void stack_push_text(char* text){
+    /* Pushes a copy of a whole string, as it is */
+    stack_push(text, 0, strlen(text), false, true);
+}
+
+stack_element * new_element(){
+    /* Takes an element from the deleted ones, or allocates one if there are none */
+    stack_element * element;
+    if(free_elements != null){
+        element = free_elements;
+        free_elements = (*free_elements).next;
+        free_element_count--;
+    }else{
+        element = polaris_malloc(sizeof(stack_element), MEMORY_STACK);
+    }
+    return element;
+}
+
+void push_element(stack_element * element){
+    (*element).next = stack;
+    stack = element;
+    if(show_pushpops) fprintf(program_output, "Push: \"%s\"\r\n", (*stack).value);
+}
+
+char * take_value(stack_element * se){
+    /* Hands the value of an element over to the caller, who must free it.
+       Values kept inside the element are copied out of it. */
+    char * value = (*se).value;
+    if(value == (*se).inline_value){
+        return copy_string(value);
     }
+    (*se).value = null;
+    return value;
 }
 
 stack_element * stack_pop(){
@@ -1108,14 +5957,36 @@ stack_element * stack_pop(){
     if(stack == null){
         error("cannot pop from an empty stack.");
     }
-    if(show_pushpops) printf("Pop: \"%s\"\r\n", (*popped).value);
+    if(show_pushpops) fprintf(program_output, "Pop: \"%s\"\r\n", (*popped).value);
     stack = (*stack).next;
     return popped;
 }
 
+stack_element * stack_peek(){
+    if(stack == null){
+        error("cannot pop from an empty stack.");
+    }
+    return stack;
+}
+
 void delete_element(stack_element * se){
-    free((*se).value);
-    free(se);
+    if((*se).value != (*se).inline_value) polaris_free((*se).value);
+    (*se).next = free_elements;
+    free_elements = se;
+    free_element_count++;
+}
+
+unsigned long polaris_ticks(){
+    /* Milliseconds on a clock that only moves forward */
+    #if OS_TYPE == 1
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (unsigned long)now.tv_sec * 1000UL + (unsigned long)(now.tv_nsec / 1000000L);
+    #elif OS_TYPE == 2
+        return (unsigned long)((double)clock() * 1000.0 / CLOCKS_PER_SEC);
+    #elif OS_TYPE == 3
+        return (unsigned long)GetTickCount();
+    #endif
 }
 
 void polaris_delay(int milliseconds){
@@ -1127,11 +5998,224 @@ void polaris_delay(int milliseconds){
         req.tv_nsec = (milliseconds % 1000L) * 1000000L;
         rem.tv_sec = 0;
         rem.tv_nsec = 0;
-        nanosleep(&req, &rem);
+        while(nanosleep(&req, &rem) != 0 && errno == EINTR){
+            /* Woken early by a signal, such as the profiling timer */
+            req = rem;
+        }
     #elif OS_TYPE == 2
         delay(milliseconds);
     #elif OS_TYPE == 3
         Sleep(milliseconds);
     #endif
     
+}
+
+void start_profiler()
+{
+    /* Samples the running code every PROFILEINTERVAL milliseconds of
+       processor time, or every PROFILESTEPS steps where there is no timer
+       for it. The profile is written at exit, and on Unix also whenever
+       the interpreter gets SIGUSR1. */
+    #if OS_TYPE == 1
+        struct sigaction action;
+        struct itimerval interval;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = profile_signal;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGPROF, &action, null);
+        sigaction(SIGUSR1, &action, null);
+        interval.it_interval.tv_sec = PROFILEINTERVAL / 1000;
+        interval.it_interval.tv_usec = (PROFILEINTERVAL % 1000) * 1000L;
+        interval.it_value = interval.it_interval;
+        setitimer(ITIMER_PROF, &interval, null);
+    #endif
+    atexit(write_profile);
+}
+
+void profile_signal(int number)
+{
+    /* Only marks the sample as due, it is taken between two steps */
+    #if OS_TYPE == 1
+        if(number == SIGUSR1){
+            profile_requested = 1;
+        }
+    #endif
+    profile_pending = 1;
+}
+
+void add_file_origin(char* contents, char* path)
+{
+    /* Remembers where the lines of a source file start before it is compiled */
+    size_t * breaks = null;
+    size_t break_count = 0;
+    size_t i;
+    for(i = 0; contents[i] != '\0'; ++i){
+        if(contents[i] == '\n'){
+            breaks = polaris_realloc(breaks, sizeof(size_t) * (break_count + 1), MEMORY_OTHER);
+            breaks[break_count++] = i;
+        }
+    }
+    add_origin(contents, path, 1, breaks, break_count, true);
+}
+
+void add_origin(char* source, char* file, unsigned long line, size_t * breaks, size_t break_count, bool whole_file)
+{
+    /* Remembers where a block is written, so it is known when it is
+       compiled. Breaks are the positions in source that were the end of a
+       line, since blocks get their newlines turned into spaces. The origin
+       takes the breaks and keeps a copy of the source, whole files also keep a
+       copy of their path. */
+    unsigned long hash = hash_string(source);
+    source_origin * origin = source_origins[hash % ORIGINCACHE];
+    while(origin != null){
+        if((*origin).hash == hash && strcmp((*origin).source, source) == 0){
+            /* The first place a block is seen is the one it is reported at */
+            if(breaks != null) polaris_free(breaks);
+            return;
+        }
+        origin = (*origin).next;
+    }
+    origin = polaris_malloc(sizeof(source_origin), MEMORY_OTHER);
+    (*origin).hash = hash;
+    (*origin).source = copy_string(source);
+    (*origin).file = whole_file ? copy_string(file) : file;
+    (*origin).line = line;
+    (*origin).breaks = breaks;
+    (*origin).break_count = break_count;
+    (*origin).next = source_origins[hash % ORIGINCACHE];
+    source_origins[hash % ORIGINCACHE] = origin;
+}
+
+void locate_tokens(code_block * code, source_origin * origin)
+{
+    /* Gives every token of a block its line, and remembers the origin of
+       the blocks and strings written in it */
+    char * source = (*code).source;
+    size_t * breaks = (*origin).breaks;
+    size_t break_count = (*origin).break_count;
+    size_t passed = 0;  /* Breaks before the current token */
+    size_t i;
+    for(i = 0; i < (*code).token_count; ++i){
+        token * current = &(*code).tokens[i];
+        while(passed < break_count && breaks[passed] < (*current).offset){
+            passed++;
+        }
+        (*current).line = (*origin).line + passed;
+        if((*current).word == WORD_STRING){
+            /* Its text is the source from the offset with every \r left out */
+            size_t * inner_breaks = null;
+            size_t inner_count = 0;
+            size_t length = strlen((*current).text);
+            size_t next = passed;
+            size_t position = (*current).offset;
+            size_t inner = 0;
+            for(; inner < length && source[position] != '\0'; ++position){
+                if(source[position] == '\r') continue;
+                while(next < break_count && breaks[next] < position) next++;
+                if(next < break_count && breaks[next] == position){
+                    inner_breaks = polaris_realloc(inner_breaks, sizeof(size_t) * (inner_count + 1), MEMORY_OTHER);
+                    inner_breaks[inner_count++] = inner;
+                }
+                inner++;
+            }
+            add_origin((*current).text, (*origin).file, (*current).line, inner_breaks, inner_count, false);
+        }
+    }
+}
+
+void take_sample()
+{
+    /* Counts one sample of the calls the current task is in */
+    frame * calls[MAXPROFILEDEPTH];
+    frame * current;
+    int depth = 0;
+    char * call_stack = null;
+    size_t length = 0;
+    size_t capacity = 0;
+    unsigned long hash;
+    profile_entry * entry;
+    profile_pending = 0;
+    if(profile_requested){
+        profile_requested = 0;
+        write_profile();
+    }
+    for(current = frames; current != null && depth < MAXPROFILEDEPTH; current = (*current).next){
+        if((*current).kind == FRAME_EVAL){
+            calls[depth++] = current;
+        }
+    }
+    if(depth == 0){
+        return;
+    }
+    while(depth > 0){
+        call_stack = describe_frame(call_stack, &length, &capacity, calls[--depth]);
+        if(depth > 0){
+            call_stack = append_text(call_stack, &length, &capacity, ";", 1);
+        }
+    }
+    hash = hash_string(call_stack);
+    for(entry = profile_entries[hash % PROFILECACHE]; entry != null; entry = (*entry).next){
+        if((*entry).hash == hash && strcmp((*entry).stack, call_stack) == 0){
+            break;
+        }
+    }
+    if(entry == null){
+        entry = polaris_malloc(sizeof(profile_entry), MEMORY_OTHER);
+        (*entry).stack = copy_string(call_stack);
+        (*entry).hash = hash;
+        (*entry).samples = 0;
+        (*entry).next = profile_entries[hash % PROFILECACHE];
+        profile_entries[hash % PROFILECACHE] = entry;
+    }
+    (*entry).samples++;
+    polaris_free(call_stack);
+}
+
+char * describe_frame(char* call_stack, size_t * length, size_t * capacity, frame * current)
+{
+    /* Appends "function (file:line)" for the token a frame is at. Blocks
+       that aren't functions only have their place, and blocks built while
+       running have no place. */
+    code_block * code = (*current).code;
+    char * name = (*code).name;
+    if(name != null){
+        call_stack = append_text(call_stack, length, capacity, name, strlen(name));
+    }
+    if((*code).file != null && (*code).token_count > 0){
+        char line_s[32];
+        size_t at = (*current).position > 0 ? (*current).position - 1 : 0;
+        if(at >= (*code).token_count) at = (*code).token_count - 1;
+        if(name != null){
+            call_stack = append_text(call_stack, length, capacity, " (", 2);
+        }
+        call_stack = append_text(call_stack, length, capacity, (*code).file, strlen((*code).file));
+        sprintf(line_s, ":%lu", (*code).tokens[at].line);
+        call_stack = append_text(call_stack, length, capacity, line_s, strlen(line_s));
+        if(name != null){
+            call_stack = append_text(call_stack, length, capacity, ")", 1);
+        }
+    }else if(name == null){
+        call_stack = append_text(call_stack, length, capacity, "<block>", 7);
+    }
+    return call_stack;
+}
+
+void write_profile()
+{
+    /* Writes every call stack sampled with how many times it was seen, in
+       the collapsed form flame graph tools read */
+    FILE * profile = fopen(profile_to_write, "w");
+    size_t bucket;
+    if(profile == null){
+        warning("couldn't write the profile.");
+        return;
+    }
+    for(bucket = 0; bucket < PROFILECACHE; ++bucket){
+        profile_entry * entry;
+        for(entry = profile_entries[bucket]; entry != null; entry = (*entry).next){
+            fprintf(profile, "%s %lu\n", (*entry).stack, (*entry).samples);
+        }
+    }
+    fclose(profile);
 }
\ No newline at end of file